@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include "Convolution.h"
+#include "FFT.h"
+#include "MatrixException.h"
+#include "ThreadPool.h"
+
+#define SEPARABLE_ERROR "The kernel is not separable.\n"
+
+// The smallest length of the transform of an overlap-add tile
+#define FFT_MIN_SIZE 128
+
+// The estimated cost of an FFT, per element and per log2 of the length,
+// in units of a direct multiply-add
+#define FFT_COST 8.0
+
+// The extra cost of the second pass of a separable convolution
+#define SEPARABLE_OVERHEAD 4.0
+
+// Relative tolerance of the rank 1 test of a kernel
+#define SEPARABLE_TOLERANCE 1e-6f
+
+// The amount of kernel spectra kept for later calls
+#define MAX_CACHED_SPECTRA 32
+
+typedef std::tuple<uint64_t, int, int, int, int> SpectrumKey;
+
+/**
+ * A cached kernel spectrum, with the kernel it was computed from.
+ */
+struct SpectrumEntry {
+    SpectrumKey key;
+    Matrix kernel;
+    std::shared_ptr<const std::vector<Complex>> spectrum;
+};
+
+// -------- Static (helper) functions --------
+
+/**
+ * Checks whether the kernel is the outer product of a column and a row.
+ * @param kernel a matrix
+ * @param column set to the column (kernel rows elements)
+ * @param row set to the row (kernel cols elements)
+ * @return true if the kernel is separable, false otherwise
+ */
+static bool SplitKernel(const Matrix& kernel, Matrix& column, Matrix& row){
+    int kh = kernel.GetRows();
+    int kw = kernel.GetCols();
+
+    // The largest element is the pivot of the factorization
+    int pr = 0;
+    int pc = 0;
+    for (int a = 0; a < kh; a++){
+        for (int b = 0; b < kw; b++){
+            if (std::fabs(kernel(a, b)) > std::fabs(kernel(pr, pc))){
+                pr = a;
+                pc = b;
+            }
+        }
+    }
+    float pivot = kernel(pr, pc);
+    if (pivot == 0){
+        return false;
+    }
+
+    column = Matrix(kh, 1);
+    row = Matrix(1, kw);
+    for (int a = 0; a < kh; a++){
+        column(a, 0) = kernel(a, pc);
+    }
+    for (int b = 0; b < kw; b++){
+        row(0, b) = kernel(pr, b) / pivot;
+    }
+
+    float tolerance = SEPARABLE_TOLERANCE * std::fabs(pivot);
+    for (int a = 0; a < kh; a++){
+        for (int b = 0; b < kw; b++){
+            if (std::fabs(kernel(a, b) - column(a, 0) * row(0, b)) > tolerance){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Chooses the tile of the overlap-add along one dimension. The transform
+ * has a power of 2 length of at least FFT_MIN_SIZE and twice the kernel, so
+ * it isn't dominated by the padding, and the tile fills the rest of it.
+ * Images which fit in a single tile are transformed whole, at the smallest
+ * length FFTPlan handles fast.
+ * @param length the length of the image
+ * @param kernel_length the length of the kernel
+ * @param tile set to the length of a tile
+ * @param fft set to the length of the transform
+ */
+static void PlanTile(int length, int kernel_length, int& tile, int& fft){
+    fft = FFT_MIN_SIZE;
+    while (fft < 2 * kernel_length){
+        fft *= 2;
+    }
+    tile = fft - kernel_length + 1;
+    if (length <= tile){
+        tile = length;
+        fft = FFTSize(length + kernel_length - 1);
+    }
+}
+
+/**
+ * Chooses the tiles of the overlap-add.
+ * @param tile_rows set to the rows of a tile
+ * @param tile_cols set to the columns of a tile
+ * @param fft_rows set to the rows of the transform
+ * @param fft_cols set to the columns of the transform
+ */
+static void PlanTiles(const Matrix& image, const Matrix& kernel, int& tile_rows, int& tile_cols,
+                      int& fft_rows, int& fft_cols){
+    PlanTile(image.GetRows(), kernel.GetRows(), tile_rows, fft_rows);
+    PlanTile(image.GetCols(), kernel.GetCols(), tile_cols, fft_cols);
+}
+
+/**
+ * @return the spectrum of the flipped kernel, zero padded to the size of
+ * the transform. The most recently used spectra are cached by the hash of
+ * the kernel and checked against a copy of it, so repeated convolutions
+ * with a kernel transform it once.
+ */
+static std::shared_ptr<const std::vector<Complex>> KernelSpectrum(const Matrix& kernel,
+                                                                  const RealFFT2D& fft,
+                                                                  int fft_rows, int fft_cols){
+    static std::mutex mutex;
+    static std::list<SpectrumEntry> entries;  // most recently used first
+    static std::map<SpectrumKey, std::list<SpectrumEntry>::iterator> index;
+
+    SpectrumKey key(kernel.Hash(), kernel.GetRows(), kernel.GetCols(), fft_rows, fft_cols);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(key);
+        if (found != index.end() && found->second->kernel == kernel){
+            entries.splice(entries.begin(), entries, found->second);
+            return found->second->spectrum;
+        }
+    }
+
+    int kh = kernel.GetRows();
+    int kw = kernel.GetCols();
+    std::vector<double> padded((size_t)fft_rows * fft_cols, 0.0);
+    for (int a = 0; a < kh; a++){
+        for (int b = 0; b < kw; b++){
+            padded[(size_t)(kh - 1 - a) * fft_cols + (kw - 1 - b)] = kernel(a, b);
+        }
+    }
+    auto spectrum = std::make_shared<std::vector<Complex>>();
+    fft.Forward(padded.data(), *spectrum);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = index.find(key);
+    if (found != index.end()){
+        entries.erase(found->second);
+    }
+    entries.push_front(SpectrumEntry{key, kernel, spectrum});
+    index[key] = entries.begin();
+    if (entries.size() > MAX_CACHED_SPECTRA){
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+    return spectrum;
+}
+
+/**
+ * Direct convolution: every kernel element adds a shifted row of the image
+ * to a row of the result, a loop the compiler vectorizes.
+ */
+static Matrix ConvolveDirect(const Matrix& image, const Matrix& kernel){
+    int rows = image.GetRows();
+    int cols = image.GetCols();
+    int kh = kernel.GetRows();
+    int kw = kernel.GetCols();
+    Matrix res(rows, cols);
+
+    ParallelRows(rows, cols * kh * kw, [&](int first, int last){
+        for (int i = first; i < last; i++){
+            float *out = res.Row(i);
+            for (int a = 0; a < kh; a++){
+                int y = i + a - kh / 2;
+                if (y < 0 || y >= rows){
+                    continue;
+                }
+                const float *src = image.Row(y);
+                const float *weights = kernel.Row(a);
+                for (int b = 0; b < kw; b++){
+                    float w = weights[b];
+                    if (w == 0){
+                        continue;
+                    }
+                    int dx = b - kw / 2;
+                    int j0 = std::max(0, -dx);
+                    int j1 = std::min(cols, cols - dx);
+                    for (int j = j0; j < j1; j++){
+                        out[j] += w * src[j + dx];
+                    }
+                }
+            }
+        }
+    });
+    return res;
+}
+
+/**
+ * FFT convolution by overlap-add: every tile of the image is transformed,
+ * multiplied by the kernel spectrum and transformed back into its full
+ * linear convolution, which is added to the result. The tiles of a tile
+ * row are transformed in parallel, and then added in a fixed order, so
+ * the result doesn't depend on the scheduling.
+ */
+static Matrix ConvolveFFT(const Matrix& image, const Matrix& kernel){
+    int rows = image.GetRows();
+    int cols = image.GetCols();
+    int kh = kernel.GetRows();
+    int kw = kernel.GetCols();
+
+    int tile_rows, tile_cols, fft_rows, fft_cols;
+    PlanTiles(image, kernel, tile_rows, tile_cols, fft_rows, fft_cols);
+    RealFFT2D fft(fft_rows, fft_cols);
+    auto kernel_spectrum = KernelSpectrum(kernel, fft, fft_rows, fft_cols);
+
+    // Element (y, x) of the full convolution of a tile at (r0, c0) belongs
+    // to the pixel (r0 + y - shift_r, c0 + x - shift_c) of the result.
+    int shift_r = kh - 1 - kh / 2;
+    int shift_c = kw - 1 - kw / 2;
+    int full_rows = tile_rows + kh - 1;
+    int full_cols = tile_cols + kw - 1;
+    int tiles_c = (cols + tile_cols - 1) / tile_cols;
+
+    Matrix res(rows, cols);
+    std::vector<std::vector<double>> outputs(tiles_c);
+    for (int r0 = 0; r0 < rows; r0 += tile_rows){
+        ThreadPool::Shared().ParallelFor(0, tiles_c, 1, [&](int first, int last){
+            std::vector<Complex> spectrum;
+            for (int t = first; t < last; t++){
+                int c0 = t * tile_cols;
+                std::vector<double> &buffer = outputs[t];
+                buffer.assign((size_t)fft_rows * fft_cols, 0.0);
+                for (int y = 0; y < tile_rows && r0 + y < rows; y++){
+                    const float *src = image.Row(r0 + y);
+                    for (int x = 0; x < tile_cols && c0 + x < cols; x++){
+                        buffer[(size_t)y * fft_cols + x] = src[c0 + x];
+                    }
+                }
+                fft.Forward(buffer.data(), spectrum);
+                for (size_t e = 0; e < spectrum.size(); e++){
+                    spectrum[e] *= (*kernel_spectrum)[e];
+                }
+                fft.Inverse(spectrum, buffer.data());
+            }
+        });
+
+        // The rows of the result this tile row reaches
+        int first_row = std::max(0, r0 - shift_r);
+        int last_row = std::min(rows, r0 + full_rows - shift_r);
+        ParallelRows(last_row - first_row, cols, [&](int first, int last){
+            for (int i = first_row + first; i < first_row + last; i++){
+                float *out = res.Row(i);
+                int y = i - r0 + shift_r;
+                for (int t = 0; t < tiles_c; t++){
+                    int c0 = t * tile_cols;
+                    const double *full = outputs[t].data() + (size_t)y * fft_cols;
+                    int x0 = std::max(0, shift_c - c0);
+                    int x1 = std::min(full_cols, cols - c0 + shift_c);
+                    for (int x = x0; x < x1; x++){
+                        out[c0 + x - shift_c] += (float)full[x];
+                    }
+                }
+            }
+        });
+    }
+    return res;
+}
+
+// -------- End of static functions --------
+
+ConvolutionMethod SelectConvolutionMethod(const Matrix& image, const Matrix& kernel) noexcept(false) {
+    double kh = kernel.GetRows();
+    double kw = kernel.GetCols();
+
+    ConvolutionMethod best = ConvolutionMethod::DIRECT;
+    double best_cost = kh * kw;
+
+    Matrix column, row;
+    if (SplitKernel(kernel, column, row) && kh + kw + SEPARABLE_OVERHEAD < best_cost){
+        best = ConvolutionMethod::SEPARABLE;
+        best_cost = kh + kw + SEPARABLE_OVERHEAD;
+    }
+
+    int tile_rows, tile_cols, fft_rows, fft_cols;
+    PlanTiles(image, kernel, tile_rows, tile_cols, fft_rows, fft_cols);
+    double elements = (double)fft_rows * fft_cols;
+    double fft_cost = FFT_COST * elements * std::log2(elements) / ((double)tile_rows * tile_cols);
+    if (fft_cost < best_cost){
+        best = ConvolutionMethod::FFT;
+    }
+    return best;
+}
+
+Matrix Convolve(const Matrix& image, const Matrix& kernel, ConvolutionMethod method) noexcept(false) {
+    if (method == ConvolutionMethod::AUTO){
+        method = SelectConvolutionMethod(image, kernel);
+    }
+
+    switch (method){
+        case ConvolutionMethod::SEPARABLE: {
+            Matrix column, row;
+            if (!SplitKernel(kernel, column, row)){
+                throw MatrixException(SEPARABLE_ERROR);
+            }
+            return ConvolveDirect(ConvolveDirect(image, row), column);
+        }
+        case ConvolutionMethod::FFT:
+            return ConvolveFFT(image, kernel);
+        default:
+            return ConvolveDirect(image, kernel);
+    }
+}
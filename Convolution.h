@@ -0,0 +1,38 @@
+#ifndef SOL_CONVOLUTION_H
+#define SOL_CONVOLUTION_H
+
+#include "Matrix.h"
+
+/**
+ * The ways Convolve can compute its result.
+ * AUTO - the cheapest of the following for the kernel and the image.
+ * DIRECT - a multiply-add per pixel and kernel element.
+ * SEPARABLE - a row pass and a column pass, for kernels which are the
+ * outer product of a column and a row (rank 1).
+ * FFT - overlap-add of FFT products, its cost per pixel hardly depends on
+ * the size of the kernel.
+ */
+enum class ConvolutionMethod { AUTO, DIRECT, SEPARABLE, FFT };
+
+/**
+ * Convolves the image with a kernel of any size. Like the convolutions of
+ * Blur and Sobel, the kernel is centered at (rows / 2, cols / 2), isn't
+ * flipped, and pixels outside of the image count as zero. The result isn't
+ * rounded or clamped.
+ * @param image a matrix
+ * @param kernel a matrix
+ * @param method the way the result is computed
+ * @return a new matrix which is the result of the convolution.
+ */
+Matrix Convolve(const Matrix& image, const Matrix& kernel,
+                ConvolutionMethod method = ConvolutionMethod::AUTO) noexcept(false);
+
+/**
+ * @param image a matrix
+ * @param kernel a matrix
+ * @return the method with the lowest estimated cost of convolving the
+ * image with the kernel (never AUTO).
+ */
+ConvolutionMethod SelectConvolutionMethod(const Matrix& image, const Matrix& kernel) noexcept(false);
+
+#endif //SOL_CONVOLUTION_H
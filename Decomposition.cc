@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Decomposition.h"
+#include "Gemm.h"
+#include "MatrixException.h"
+#include "ThreadPool.h"
+
+#define DIMENSION_ERROR "Invalid matrix dimensions.\n"
+#define SINGULAR_ERROR "The matrix is singular.\n"
+#define NOT_POSITIVE_DEFINITE_ERROR "The matrix is not positive definite.\n"
+
+// -------- Static (helper) functions --------
+
+/**
+ * @param m a matrix
+ * @return the elements of the matrix row by row, in one buffer.
+ */
+static std::vector<float> ToBuffer(const Matrix &m){
+    std::vector<float> buffer((size_t)m.GetRows() * m.GetCols());
+    for (int i = 0; i < m.GetRows(); i++){
+        std::copy(m.Row(i), m.Row(i) + m.GetCols(), buffer.begin() + (long)i * m.GetCols());
+    }
+    return buffer;
+}
+
+/**
+ * @param buffer rows x cols elements, row by row
+ * @return a new matrix with the elements.
+ */
+static Matrix FromBuffer(const float *buffer, int rows, int cols){
+    Matrix m(rows, cols);
+    for (int i = 0; i < rows; i++){
+        std::copy(buffer + (long)i * cols, buffer + (long)(i + 1) * cols, m.Row(i));
+    }
+    return m;
+}
+
+/**
+ * @param n an integer
+ * @return the n x n identity matrix.
+ */
+static Matrix Identity(int n){
+    Matrix m(n, n);
+    for (int i = 0; i < n; i++){
+        m(i, i) = 1;
+    }
+    return m;
+}
+
+/**
+ * row[0, count) -= factor * source[0, count)
+ */
+static void SubtractRow(float *row, const float *source, float factor, int count){
+    for (int x = 0; x < count; x++){
+        row[x] -= factor * source[x];
+    }
+}
+
+/**
+ * Solves L * X = B in place, where L is the n x n lower triangle of l.
+ * Diagonal blocks are solved by substitution, and the rows below every
+ * block are updated with a GEMM.
+ * @param unit true if the diagonal of L is all ones (and isn't read)
+ * @param b n x m elements, overwritten by X
+ */
+static void SolveLower(const float *l, int n, bool unit, float *b, int m){
+    for (int k0 = 0; k0 < n; k0 += FACTOR_BLOCK){
+        int kb = std::min(FACTOR_BLOCK, n - k0);
+        for (int i = k0; i < k0 + kb; i++){
+            float *row = b + (long)i * m;
+            for (int p = k0; p < i; p++){
+                SubtractRow(row, b + (long)p * m, l[(long)i * n + p], m);
+            }
+            if (!unit){
+                float diagonal = l[(long)i * n + i];
+                for (int x = 0; x < m; x++){
+                    row[x] /= diagonal;
+                }
+            }
+        }
+        int below = n - k0 - kb;
+        Gemm(below, m, kb, -1.0f, l + (long)(k0 + kb) * n + k0, n, b + (long)k0 * m, m, false,
+             1.0f, b + (long)(k0 + kb) * m, m);
+    }
+}
+
+/**
+ * Solves U * X = B in place, where U is the n x n upper triangle of u,
+ * from the last diagonal block up.
+ * @param b n x m elements, overwritten by X
+ */
+static void SolveUpper(const float *u, int n, float *b, int m){
+    for (int k1 = n; k1 > 0; k1 -= FACTOR_BLOCK){
+        int k0 = std::max(0, k1 - FACTOR_BLOCK);
+        for (int i = k1 - 1; i >= k0; i--){
+            float *row = b + (long)i * m;
+            for (int p = i + 1; p < k1; p++){
+                SubtractRow(row, b + (long)p * m, u[(long)i * n + p], m);
+            }
+            float diagonal = u[(long)i * n + i];
+            for (int x = 0; x < m; x++){
+                row[x] /= diagonal;
+            }
+        }
+        Gemm(k0, m, k1 - k0, -1.0f, u + k0, n, b + (long)k0 * m, m, false, 1.0f, b, m);
+    }
+}
+
+// -------- End of static functions --------
+
+LU::LU(const Matrix &a) noexcept(false) {
+    if (a.GetRows() != a.GetCols()){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    int n = a.GetRows();
+    this->n_ = n;
+    this->lu_ = ToBuffer(a);
+    this->pivots_.resize(n);
+    this->sign_ = 1;
+    this->singular_ = false;
+    float *lu = lu_.data();
+
+    for (int k0 = 0; k0 < n; k0 += FACTOR_BLOCK){
+        int kb = std::min(FACTOR_BLOCK, n - k0);
+        int k1 = k0 + kb;
+
+        // Factor the panel: the columns [k0, k1) of the rows [k0, n)
+        for (int j = k0; j < k1; j++){
+            int pivot = j;
+            for (int i = j + 1; i < n; i++){
+                if (std::fabs(lu[(long)i * n + j]) > std::fabs(lu[(long)pivot * n + j])){
+                    pivot = i;
+                }
+            }
+            pivots_[j] = pivot;
+            if (pivot != j){
+                std::swap_ranges(lu + (long)j * n, lu + (long)(j + 1) * n, lu + (long)pivot * n);
+                sign_ = -sign_;
+            }
+
+            float diagonal = lu[(long)j * n + j];
+            if (diagonal == 0){
+                singular_ = true;
+                continue;
+            }
+            const float *pivot_row = lu + (long)j * n;
+            for (int i = j + 1; i < n; i++){
+                float *row = lu + (long)i * n;
+                row[j] /= diagonal;
+                SubtractRow(row + j + 1, pivot_row + j + 1, row[j], k1 - j - 1);
+            }
+        }
+
+        // U12 = L11^-1 * A12
+        for (int i = k0 + 1; i < k1; i++){
+            float *row = lu + (long)i * n;
+            for (int p = k0; p < i; p++){
+                SubtractRow(row + k1, lu + (long)p * n + k1, row[p], n - k1);
+            }
+        }
+
+        // A22 -= L21 * U12
+        Gemm(n - k1, n - k1, kb, -1.0f, lu + (long)k1 * n + k0, n, lu + (long)k0 * n + k1, n, false,
+             1.0f, lu + (long)k1 * n + k1, n);
+    }
+}
+
+int LU::GetSize() const noexcept {
+    return this->n_;
+}
+
+bool LU::IsSingular() const noexcept {
+    return this->singular_;
+}
+
+double LU::Determinant() const noexcept {
+    double det = sign_;
+    for (int i = 0; i < n_; i++){
+        det *= lu_[(long)i * n_ + i];
+    }
+    return det;
+}
+
+double LU::LogDeterminant(int &sign) const noexcept {
+    sign = sign_;
+    double log_det = 0;
+    for (int i = 0; i < n_; i++){
+        double pivot = lu_[(long)i * n_ + i];
+        if (pivot == 0){
+            sign = 0;
+            return -std::numeric_limits<double>::infinity();
+        }
+        if (pivot < 0){
+            sign = -sign;
+        }
+        log_det += std::log(std::fabs(pivot));
+    }
+    return log_det;
+}
+
+Matrix LU::Solve(const Matrix &b) const noexcept(false) {
+    if (b.GetRows() != n_){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    if (singular_){
+        throw MatrixException(SINGULAR_ERROR);
+    }
+    int m = b.GetCols();
+    std::vector<float> x = ToBuffer(b);
+
+    // Apply the row swaps in the order they were made
+    for (int i = 0; i < n_; i++){
+        if (pivots_[i] != i){
+            std::swap_ranges(x.begin() + (long)i * m, x.begin() + (long)(i + 1) * m,
+                             x.begin() + (long)pivots_[i] * m);
+        }
+    }
+    SolveLower(lu_.data(), n_, true, x.data(), m);
+    SolveUpper(lu_.data(), n_, x.data(), m);
+    return FromBuffer(x.data(), n_, m);
+}
+
+Matrix LU::Inverse() const noexcept(false) {
+    return Solve(Identity(n_));
+}
+
+Cholesky::Cholesky(const Matrix &a) noexcept(false) {
+    if (a.GetRows() != a.GetCols()){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    int n = a.GetRows();
+    this->n_ = n;
+    this->l_ = ToBuffer(a);
+    float *l = l_.data();
+
+    for (int k0 = 0; k0 < n; k0 += FACTOR_BLOCK){
+        int kb = std::min(FACTOR_BLOCK, n - k0);
+        int k1 = k0 + kb;
+
+        // Factor the diagonal block, the columns before k0 were already
+        // subtracted by the trailing updates
+        for (int j = k0; j < k1; j++){
+            float *row_j = l + (long)j * n;
+            double d = row_j[j];
+            for (int p = k0; p < j; p++){
+                d -= (double)row_j[p] * row_j[p];
+            }
+            if (!(d > 0)){
+                throw MatrixException(NOT_POSITIVE_DEFINITE_ERROR);
+            }
+            row_j[j] = (float)std::sqrt(d);
+            for (int i = j + 1; i < k1; i++){
+                float *row_i = l + (long)i * n;
+                double s = row_i[j];
+                for (int p = k0; p < j; p++){
+                    s -= (double)row_i[p] * row_j[p];
+                }
+                row_i[j] = (float)(s / row_j[j]);
+            }
+        }
+
+        // L21 = A21 * L11^-T, every row on its own
+        ParallelRows(n - k1, kb * kb, [&](int first, int last){
+            for (int i = k1 + first; i < k1 + last; i++){
+                float *row_i = l + (long)i * n;
+                for (int j = k0; j < k1; j++){
+                    const float *row_j = l + (long)j * n;
+                    float s = row_i[j];
+                    for (int p = k0; p < j; p++){
+                        s -= row_i[p] * row_j[p];
+                    }
+                    row_i[j] = s / row_j[j];
+                }
+            }
+        });
+
+        // A22 -= L21 * L21^T, on and below the diagonal only: every block
+        // column of the trailing matrix from its diagonal down
+        for (int jb = k1; jb < n; jb += FACTOR_BLOCK){
+            int width = std::min(FACTOR_BLOCK, n - jb);
+            Gemm(n - jb, width, kb, -1.0f, l + (long)jb * n + k0, n, l + (long)jb * n + k0, n, true,
+                 1.0f, l + (long)jb * n + jb, n);
+        }
+    }
+
+    // Clear the upper triangle
+    for (int i = 0; i < n; i++){
+        std::fill(l + (long)i * n + i + 1, l + (long)(i + 1) * n, 0.0f);
+    }
+}
+
+int Cholesky::GetSize() const noexcept {
+    return this->n_;
+}
+
+Matrix Cholesky::GetL() const noexcept(false) {
+    return FromBuffer(l_.data(), n_, n_);
+}
+
+double Cholesky::Determinant() const noexcept {
+    double det = 1;
+    for (int i = 0; i < n_; i++){
+        double diagonal = l_[(long)i * n_ + i];
+        det *= diagonal * diagonal;
+    }
+    return det;
+}
+
+double Cholesky::LogDeterminant() const noexcept {
+    double log_det = 0;
+    for (int i = 0; i < n_; i++){
+        log_det += 2 * std::log((double)l_[(long)i * n_ + i]);
+    }
+    return log_det;
+}
+
+Matrix Cholesky::Solve(const Matrix &b) const noexcept(false) {
+    if (b.GetRows() != n_){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    int m = b.GetCols();
+    std::vector<float> x = ToBuffer(b);
+
+    // L * Y = B, then L^T * X = Y
+    SolveLower(l_.data(), n_, false, x.data(), m);
+    std::vector<float> lt((size_t)n_ * n_);
+    for (int i = 0; i < n_; i++){
+        for (int j = 0; j <= i; j++){
+            lt[(long)j * n_ + i] = l_[(long)i * n_ + j];
+        }
+    }
+    SolveUpper(lt.data(), n_, x.data(), m);
+    return FromBuffer(x.data(), n_, m);
+}
+
+Matrix Cholesky::Inverse() const noexcept(false) {
+    return Solve(Identity(n_));
+}
+
+Matrix Solve(const Matrix &a, const Matrix &b) noexcept(false) {
+    return LU(a).Solve(b);
+}
+
+Matrix Inverse(const Matrix &a) noexcept(false) {
+    return LU(a).Inverse();
+}
+
+double Determinant(const Matrix &a) noexcept(false) {
+    return LU(a).Determinant();
+}
+
+double LogDeterminant(const Matrix &a, int &sign) noexcept(false) {
+    return LU(a).LogDeterminant(sign);
+}
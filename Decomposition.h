@@ -0,0 +1,154 @@
+#ifndef SOL_DECOMPOSITION_H
+#define SOL_DECOMPOSITION_H
+
+#include <vector>
+#include "Matrix.h"
+
+// The width of the panels of the blocked factorizations
+#define FACTOR_BLOCK 64
+
+/**
+ * LU factorization with partial pivoting, P * A = L * U, of a square
+ * matrix. It is blocked and right looking: every panel of FACTOR_BLOCK
+ * columns is factored, and the trailing matrix is updated with a single
+ * GEMM.
+ */
+class LU {
+
+private:
+
+    int n_;
+    std::vector<float> lu_;  // L below the diagonal (unit diagonal), U on and above it
+    std::vector<int> pivots_;  // row i was swapped with row pivots_[i]
+    int sign_;  // the sign of the permutation
+    bool singular_;
+
+public:
+
+    /**
+     * Factors the matrix.
+     * @param a a square matrix
+     */
+    explicit LU(const Matrix &a) noexcept(false);
+
+    /**
+     * @return the amount of rows (and columns) of the matrix.
+     */
+    int GetSize() const noexcept;
+
+    /**
+     * @return true if the matrix is singular (a pivot is zero).
+     */
+    bool IsSingular() const noexcept;
+
+    /**
+     * @return the determinant of the matrix, in double precision. It may
+     * still overflow for large matrices, see LogDeterminant.
+     */
+    double Determinant() const noexcept;
+
+    /**
+     * @param sign set to the sign of the determinant: 1, -1, or 0 if the
+     * matrix is singular
+     * @return the natural logarithm of the absolute value of the
+     * determinant (-infinity if the matrix is singular), which doesn't
+     * overflow.
+     */
+    double LogDeterminant(int &sign) const noexcept;
+
+    /**
+     * Solves A * X = B.
+     * @param b a matrix with the rows of A (every column is a system)
+     * @return X, a new matrix of the size of b.
+     */
+    Matrix Solve(const Matrix &b) const noexcept(false);
+
+    /**
+     * @return the inverse of the matrix.
+     */
+    Matrix Inverse() const noexcept(false);
+};
+
+/**
+ * Cholesky factorization, A = L * L^T, of a symmetric positive definite
+ * matrix, blocked and right looking like LU. Only the lower triangle of
+ * the matrix is read.
+ */
+class Cholesky {
+
+private:
+
+    int n_;
+    std::vector<float> l_;  // L on and below the diagonal
+
+public:
+
+    /**
+     * Factors the matrix.
+     * @param a a symmetric positive definite matrix
+     */
+    explicit Cholesky(const Matrix &a) noexcept(false);
+
+    /**
+     * @return the amount of rows (and columns) of the matrix.
+     */
+    int GetSize() const noexcept;
+
+    /**
+     * @return the lower triangular factor L.
+     */
+    Matrix GetL() const noexcept(false);
+
+    /**
+     * @return the determinant of the matrix, in double precision. It may
+     * still overflow for large matrices, see LogDeterminant.
+     */
+    double Determinant() const noexcept;
+
+    /**
+     * @return the natural logarithm of the determinant of the matrix
+     * (which is positive), which doesn't overflow.
+     */
+    double LogDeterminant() const noexcept;
+
+    /**
+     * Solves A * X = B.
+     * @param b a matrix with the rows of A (every column is a system)
+     * @return X, a new matrix of the size of b.
+     */
+    Matrix Solve(const Matrix &b) const noexcept(false);
+
+    /**
+     * @return the inverse of the matrix.
+     */
+    Matrix Inverse() const noexcept(false);
+};
+
+/**
+ * @param a a square matrix
+ * @param b a matrix with the rows of a
+ * @return X such that a * X = b, by LU factorization.
+ */
+Matrix Solve(const Matrix &a, const Matrix &b) noexcept(false);
+
+/**
+ * @param a a square matrix
+ * @return the inverse of a, by LU factorization.
+ */
+Matrix Inverse(const Matrix &a) noexcept(false);
+
+/**
+ * @param a a square matrix
+ * @return the determinant of a, by LU factorization.
+ */
+double Determinant(const Matrix &a) noexcept(false);
+
+/**
+ * @param a a square matrix
+ * @param sign set to the sign of the determinant of a (0 if it's singular)
+ * @return the natural logarithm of the absolute value of the determinant
+ * of a, by LU factorization.
+ */
+double LogDeterminant(const Matrix &a, int &sign) noexcept(false);
+
+#endif //SOL_DECOMPOSITION_H
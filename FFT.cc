@@ -0,0 +1,204 @@
+#include <cmath>
+#include "FFT.h"
+#include "MatrixException.h"
+
+#define SIZE_ERROR "Invalid transform length.\n"
+
+// Butterflies up to this radix keep their temporaries on the stack
+#define MAX_STACK_RADIX 8
+
+// -------- Private functions --------
+
+void FFTPlan::Transform(const Complex *in, Complex *out, int n, int stride,
+                        int depth, bool inverse) const noexcept(false) {
+    if (n == 1){
+        out[0] = in[0];
+        return;
+    }
+
+    int p = factors_[depth];
+    int m = n / p;
+
+    // Transform the p interleaved subsequences into consecutive blocks of m
+    for (int q = 0; q < p; q++){
+        Transform(in + (long)q * stride, out + (long)q * m, m, stride * p, depth + 1, inverse);
+    }
+
+    // e^(-2 pi i e / n) is twiddles_[e * step], every e below is less than n
+    long step = size_ / n;
+    auto twiddle = [&](long e){
+        const Complex &w = twiddles_[e * step];
+        return inverse ? std::conj(w) : w;
+    };
+
+    if (p == 2){
+        for (int k = 0; k < m; k++){
+            Complex a = out[k];
+            Complex b = out[k + m] * twiddle(k);
+            out[k] = a + b;
+            out[k + m] = a - b;
+        }
+        return;
+    }
+
+    // A butterfly of radix p: a DFT of length p over the twiddled blocks
+    Complex small[MAX_STACK_RADIX];
+    std::vector<Complex> large(p > MAX_STACK_RADIX ? p : 0);
+    Complex *temp = p > MAX_STACK_RADIX ? large.data() : small;
+    for (int k = 0; k < m; k++){
+        for (int q = 0; q < p; q++){
+            temp[q] = out[k + (long)q * m] * twiddle((long)q * k);
+        }
+        for (int r = 0; r < p; r++){
+            Complex sum = temp[0];
+            for (int q = 1; q < p; q++){
+                sum += temp[q] * twiddle(((long)q * r % p) * m);
+            }
+            out[k + (long)r * m] = sum;
+        }
+    }
+}
+
+// -------- End of private functions --------
+
+FFTPlan::FFTPlan(int size) noexcept(false) {
+    if (size <= 0){
+        throw MatrixException(SIZE_ERROR);
+    }
+    this->size_ = size;
+
+    int rest = size;
+    for (int p = 2; p * p <= rest; p++){
+        while (rest % p == 0){
+            factors_.push_back(p);
+            rest /= p;
+        }
+    }
+    if (rest > 1){
+        factors_.push_back(rest);
+    }
+
+    double pi = std::acos(-1.0);
+    twiddles_.resize(size);
+    for (int k = 0; k < size; k++){
+        twiddles_[k] = std::polar(1.0, -2 * pi * k / size);
+    }
+}
+
+int FFTPlan::GetSize() const noexcept {
+    return this->size_;
+}
+
+void FFTPlan::Forward(Complex *data) const noexcept(false) {
+    std::vector<Complex> in(data, data + size_);
+    Transform(in.data(), data, size_, 1, 0, false);
+}
+
+void FFTPlan::Inverse(Complex *data) const noexcept(false) {
+    std::vector<Complex> in(data, data + size_);
+    Transform(in.data(), data, size_, 1, 0, true);
+}
+
+RealFFT2D::RealFFT2D(int rows, int cols) noexcept(false)
+    : rows_(rows), cols_(cols), row_plan_(cols), col_plan_(rows) {}
+
+int RealFFT2D::GetSpectrumCols() const noexcept {
+    return cols_ / 2 + 1;
+}
+
+void RealFFT2D::Forward(const double *real, std::vector<Complex> &spectrum) const noexcept(false) {
+    int half = GetSpectrumCols();
+    spectrum.assign((size_t)rows_ * half, Complex());
+    std::vector<Complex> z(cols_);
+
+    // Rows: z = a + ib, then A[k] = (Z[k] + conj(Z[-k])) / 2 and
+    // B[k] = (Z[k] - conj(Z[-k])) / 2i
+    for (int r = 0; r < rows_; r += 2){
+        const double *a = real + (size_t)r * cols_;
+        const double *b = (r + 1 < rows_) ? a + cols_ : nullptr;
+        for (int x = 0; x < cols_; x++){
+            z[x] = Complex(a[x], b ? b[x] : 0.0);
+        }
+        row_plan_.Forward(z.data());
+
+        Complex *out_a = spectrum.data() + (size_t)r * half;
+        for (int k = 0; k < half; k++){
+            Complex zk = z[k];
+            Complex zn = std::conj(z[(cols_ - k) % cols_]);
+            out_a[k] = (zk + zn) * 0.5;
+            if (b){
+                out_a[half + k] = (zk - zn) * Complex(0, -0.5);
+            }
+        }
+    }
+
+    // Columns
+    std::vector<Complex> column(rows_);
+    for (int k = 0; k < half; k++){
+        for (int r = 0; r < rows_; r++){
+            column[r] = spectrum[(size_t)r * half + k];
+        }
+        col_plan_.Forward(column.data());
+        for (int r = 0; r < rows_; r++){
+            spectrum[(size_t)r * half + k] = column[r];
+        }
+    }
+}
+
+void RealFFT2D::Inverse(std::vector<Complex> &spectrum, double *real) const noexcept(false) {
+    int half = GetSpectrumCols();
+    double scale = 1.0 / ((double)rows_ * cols_);
+
+    // Columns
+    std::vector<Complex> column(rows_);
+    for (int k = 0; k < half; k++){
+        for (int r = 0; r < rows_; r++){
+            column[r] = spectrum[(size_t)r * half + k];
+        }
+        col_plan_.Inverse(column.data());
+        for (int r = 0; r < rows_; r++){
+            spectrum[(size_t)r * half + k] = column[r];
+        }
+    }
+
+    // Rows: the spectra of real rows are hermitian, so the missing columns
+    // are conjugates, and Z = A + iB transforms back into z = a + ib.
+    std::vector<Complex> z(cols_);
+    for (int r = 0; r < rows_; r += 2){
+        const Complex *in_a = spectrum.data() + (size_t)r * half;
+        const Complex *in_b = (r + 1 < rows_) ? in_a + half : nullptr;
+        for (int k = 0; k < cols_; k++){
+            bool stored = k < half;
+            int source = stored ? k : cols_ - k;
+            Complex a = stored ? in_a[source] : std::conj(in_a[source]);
+            Complex b;
+            if (in_b){
+                b = stored ? in_b[source] : std::conj(in_b[source]);
+            }
+            z[k] = a + Complex(0, 1) * b;
+        }
+        row_plan_.Inverse(z.data());
+
+        double *out_a = real + (size_t)r * cols_;
+        for (int x = 0; x < cols_; x++){
+            out_a[x] = z[x].real() * scale;
+            if (in_b){
+                out_a[cols_ + x] = z[x].imag() * scale;
+            }
+        }
+    }
+}
+
+int FFTSize(int n) noexcept {
+    for (int size = (n > 1 ? n : 1); ; size++){
+        int rest = size;
+        for (int p : {2, 3, 5}){
+            while (rest % p == 0){
+                rest /= p;
+            }
+        }
+        if (rest == 1){
+            return size;
+        }
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef SOL_FFT_H
+#define SOL_FFT_H
+
+#include <complex>
+#include <vector>
+
+typedef std::complex<double> Complex;
+
+/**
+ * A mixed radix (2, 3, 5 and any other prime) Cooley-Tukey transform of a
+ * fixed length. The factors and the twiddles are computed once, so a plan
+ * is built once and used for many transforms.
+ */
+class FFTPlan {
+
+private:
+
+    int size_;
+    std::vector<int> factors_;
+    std::vector<Complex> twiddles_;  // e^(-2 pi i k / size) for every k
+
+    /**
+     * Transforms the n elements in[0], in[stride], ... into out[0, n),
+     * decimating in time by factors_[depth].
+     * @param inverse true for the inverse transform (unnormalized)
+     */
+    void Transform(const Complex *in, Complex *out, int n, int stride,
+                   int depth, bool inverse) const noexcept(false);
+
+public:
+
+    /**
+     * Constructs the plan of a transform of the given length.
+     * @param size the length (positive)
+     */
+    explicit FFTPlan(int size) noexcept(false);
+
+    /**
+     * @return the length of the transform (int).
+     */
+    int GetSize() const noexcept;
+
+    /**
+     * Forward transform in place: X[k] = sum x[n] e^(-2 pi i k n / size).
+     * @param data size elements
+     */
+    void Forward(Complex *data) const noexcept(false);
+
+    /**
+     * Inverse transform in place, without the 1 / size normalization.
+     * @param data size elements
+     */
+    void Inverse(Complex *data) const noexcept(false);
+};
+
+/**
+ * A 2-dimensional transform of real rows x cols data. Only the
+ * cols / 2 + 1 non redundant columns of the spectrum are kept; two real
+ * rows are transformed at once as the real and the imaginary parts of one
+ * complex row.
+ */
+class RealFFT2D {
+
+private:
+
+    int rows_;
+    int cols_;
+    FFTPlan row_plan_;
+    FFTPlan col_plan_;
+
+public:
+
+    /**
+     * @param rows the rows of the data (positive)
+     * @param cols the columns of the data (positive)
+     */
+    RealFFT2D(int rows, int cols) noexcept(false);
+
+    /**
+     * @return the columns of the spectrum: cols / 2 + 1.
+     */
+    int GetSpectrumCols() const noexcept;
+
+    /**
+     * @param real rows x cols elements, row by row
+     * @param spectrum set to rows x GetSpectrumCols() elements, row by row
+     */
+    void Forward(const double *real, std::vector<Complex> &spectrum) const noexcept(false);
+
+    /**
+     * The normalized inverse of Forward, the spectrum is overwritten.
+     * @param spectrum rows x GetSpectrumCols() elements, row by row
+     * @param real set to rows x cols elements, row by row
+     */
+    void Inverse(std::vector<Complex> &spectrum, double *real) const noexcept(false);
+};
+
+/**
+ * @param n a positive integer
+ * @return the smallest integer >= n whose prime factors are 2, 3 and 5
+ * only, which are the fastest lengths to transform.
+ */
+int FFTSize(int n) noexcept;
+
+#endif //SOL_FFT_H
@@ -0,0 +1,260 @@
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <utility>
+#include "FilterCache.h"
+#include "MatrixException.h"
+
+#define CAPACITY_ERROR "Invalid cache capacity.\n"
+#define DIRECTORY_ERROR "Cannot create the cache directory.\n"
+
+#define CACHE_FILE_EXTENSION ".mat"
+
+// A cache file with a larger matrix is taken as corrupt
+#define MAX_CACHE_ELEMENTS (1L << 26)
+
+// -------- Static (helper) functions --------
+
+/**
+ * Writes a matrix in binary: rows, columns, then the rows of elements.
+ * @param file a binary stream
+ * @param mat a matrix
+ */
+static void WriteMatrix(std::ofstream &file, const Matrix &mat){
+    int dims[2] = {mat.GetRows(), mat.GetCols()};
+    file.write((const char *)dims, sizeof(dims));
+    for (int i = 0; i < mat.GetRows(); i++){
+        file.write((const char *)mat.Row(i), (std::streamsize)(sizeof(float) * mat.GetCols()));
+    }
+}
+
+/**
+ * Reads a matrix written by WriteMatrix.
+ * @param file a binary stream
+ * @param mat set to the matrix
+ * @return true if the operation succeeded, false otherwise (also when the
+ * dimensions are more than the rest of the file holds).
+ */
+static bool ReadMatrix(std::ifstream &file, Matrix &mat){
+    int dims[2];
+    if (!file.read((char *)dims, sizeof(dims)) || dims[0] <= 0 || dims[1] <= 0){
+        return false;
+    }
+    std::streamoff start = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff left = file.tellg() - start;
+    file.seekg(start);
+    long elements = (long)dims[0] * dims[1];
+    if (!file || elements > MAX_CACHE_ELEMENTS || elements * (long)sizeof(float) > left){
+        return false;
+    }
+    Matrix read(dims[0], dims[1]);
+    for (int i = 0; i < dims[0]; i++){
+        if (!file.read((char *)read.Row(i), (std::streamsize)(sizeof(float) * dims[1]))){
+            return false;
+        }
+    }
+    mat = std::move(read);
+    return true;
+}
+
+/**
+ * Writes the input and the result of a filter to a file. The file is
+ * written aside, under a name no other thread or process uses, and renamed,
+ * so readers never see half a file.
+ * @param path path to the file
+ * @param source the input
+ * @param result the result
+ * @return true if the operation succeeded, false otherwise.
+ */
+static bool WriteCacheFile(const std::string &path, const Matrix &source, const Matrix &result){
+    static std::atomic<unsigned long> files{0};
+    std::string temp = path + "." + std::to_string(getpid()) + "." + std::to_string(files++) + ".tmp";
+    {
+        std::ofstream file(temp, std::ios::binary);
+        if (!file.is_open()){
+            return false;
+        }
+        WriteMatrix(file, source);
+        WriteMatrix(file, result);
+        if (!file.good()){
+            file.close();
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0){
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Reads a file written by WriteCacheFile.
+ * @param path path to the file
+ * @param source set to the input in the file
+ * @param result set to the result in the file
+ * @return true if the operation succeeded, false otherwise.
+ */
+static bool ReadCacheFile(const std::string &path, Matrix &source, Matrix &result){
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()){
+        return false;
+    }
+    return ReadMatrix(file, source) && ReadMatrix(file, result);
+}
+
+/**
+ * Removes the given files.
+ */
+static void RemoveFiles(const std::vector<std::string> &paths){
+    for (const std::string &path : paths){
+        std::remove(path.c_str());
+    }
+}
+
+// -------- End of static functions --------
+
+// -------- Private functions --------
+
+std::string FilterCache::PathOf(const std::string &key) const {
+    return directory_ + "/" + key + CACHE_FILE_EXTENSION;
+}
+
+bool FilterCache::Lookup(const std::string &key, const Matrix &source, Matrix &result) noexcept(false) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = index_.find(key);
+        if (found != index_.end()){
+            // Move the entry to the front
+            entries_.splice(entries_.begin(), entries_, found->second);
+        }
+        if (directory_.empty()){
+            if (found == index_.end() || found->second->source != source){
+                return false;
+            }
+            result = found->second->result;
+            return true;
+        }
+    }
+
+    // The file may also have been stored by an earlier process
+    Matrix stored;
+    bool read = ReadCacheFile(PathOf(key), stored, result);
+    std::vector<std::string> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = index_.find(key);
+        if (!read && found != index_.end()){
+            entries_.erase(found->second);
+            index_.erase(found);
+        }
+        else if (read && found == index_.end()){
+            evicted = Insert(key, Matrix(), Matrix());
+        }
+    }
+    RemoveFiles(evicted);
+    return read && stored == source;
+}
+
+void FilterCache::Store(const std::string &key, const Matrix &source, const Matrix &result) noexcept(false) {
+    bool in_memory = directory_.empty();
+    if (!in_memory && !WriteCacheFile(PathOf(key), source, result)){
+        return;
+    }
+    std::vector<std::string> evicted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = index_.find(key);
+        if (found != index_.end()){
+            entries_.erase(found->second);
+            index_.erase(found);
+        }
+        evicted = in_memory ? Insert(key, source, result) : Insert(key, Matrix(), Matrix());
+    }
+    RemoveFiles(evicted);
+}
+
+std::vector<std::string> FilterCache::Insert(const std::string &key, const Matrix &source,
+                                             const Matrix &result) noexcept(false) {
+    entries_.push_front(Entry{key, source, result});
+    index_[key] = entries_.begin();
+
+    std::vector<std::string> evicted;
+    while (entries_.size() > capacity_){
+        const Entry &oldest = entries_.back();
+        if (!directory_.empty()){
+            evicted.push_back(PathOf(oldest.key));
+        }
+        index_.erase(oldest.key);
+        entries_.pop_back();
+    }
+    return evicted;
+}
+
+// -------- End of private functions --------
+
+FilterCache::FilterCache(size_t capacity) noexcept(false) : FilterCache(capacity, "") {}
+
+FilterCache::FilterCache(size_t capacity, const std::string &directory) noexcept(false) {
+    if (capacity == 0){
+        throw MatrixException(CAPACITY_ERROR);
+    }
+    this->capacity_ = capacity;
+    this->directory_ = directory;
+
+    if (!directory.empty()){
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        if (!std::filesystem::is_directory(directory)){
+            throw MatrixException(DIRECTORY_ERROR);
+        }
+    }
+}
+
+Matrix FilterCache::Apply(const std::string &filter, int parameter, const Matrix &image,
+                          const std::function<Matrix(const Matrix&)> &compute) noexcept(false) {
+    std::ostringstream key;
+    key << std::hex << image.Hash() << std::dec << "_" << image.GetRows() << "x"
+        << image.GetCols() << "_" << filter << "_" << parameter;
+
+    Matrix result;
+    if (Lookup(key.str(), image, result)){
+        hits_++;
+        return result;
+    }
+
+    // Computed outside of the lock, so other keys aren't blocked meanwhile
+    result = compute(image);
+    Store(key.str(), image, result);
+    misses_++;
+    return result;
+}
+
+Matrix FilterCache::Blur(const Matrix &image) noexcept(false) {
+    return Apply("blur", 0, image, [](const Matrix &m){ return ::Blur(m); });
+}
+
+Matrix FilterCache::Sobel(const Matrix &image) noexcept(false) {
+    return Apply("sobel", 0, image, [](const Matrix &m){ return ::Sobel(m); });
+}
+
+Matrix FilterCache::Quantization(const Matrix &image, int levels,
+                                 QuantizationMode mode) noexcept(false) {
+    std::string filter = "quant" + std::to_string((int)mode);
+    return Apply(filter, levels, image, [levels, mode](const Matrix &m){
+        return ::Quantization(m, levels, mode);
+    });
+}
+
+long FilterCache::GetHits() const noexcept {
+    return hits_;
+}
+
+long FilterCache::GetMisses() const noexcept {
+    return misses_;
+}
@@ -0,0 +1,143 @@
+#ifndef SOL_FILTER_CACHE_H
+#define SOL_FILTER_CACHE_H
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Matrix.h"
+#include "Filters.h"
+
+/**
+ * A bounded LRU cache of filter results, keyed on the content hash of the
+ * input image, the name of the filter and its parameter. A repeated call
+ * on byte-identical input costs one hash pass and one comparison instead
+ * of the filter: every entry keeps its input, which a hit is checked
+ * against, so a hash collision (or a stale hash) costs a miss rather than
+ * a wrong result. Results are kept in memory, or as files in a local
+ * directory - in which case they also survive the process.
+ */
+class FilterCache {
+
+private:
+
+    struct Entry {
+        std::string key;
+        Matrix source;  // unused when the results are kept on disk
+        Matrix result;  // unused when the results are kept on disk
+    };
+
+    size_t capacity_;
+    std::string directory_;  // empty when the results are kept in memory
+    std::list<Entry> entries_;  // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    std::atomic<long> hits_{0};
+    std::atomic<long> misses_{0};
+    mutable std::mutex mutex_;
+
+    /**
+     * @param key a key
+     * @return the path of the file which holds the result of the key.
+     */
+    std::string PathOf(const std::string &key) const;
+
+    /**
+     * Looks the key up and marks it as the most recently used. Files are
+     * read without holding the mutex.
+     * @param key a key
+     * @param source the input of the filter, which the stored input must equal
+     * @param result set to the stored result if the key was found
+     * @return true if the key was found with the same input, false otherwise
+     */
+    bool Lookup(const std::string &key, const Matrix &source, Matrix &result) noexcept(false);
+
+    /**
+     * Stores the input and the result of the key, replacing an entry of the
+     * key, and evicts the least recently used results when the cache is
+     * full. Files are written without holding the mutex.
+     * @param key a key
+     * @param source the input of the filter
+     * @param result the result of the key
+     */
+    void Store(const std::string &key, const Matrix &source, const Matrix &result) noexcept(false);
+
+    /**
+     * Inserts the key as the most recently used entry and evicts entries
+     * beyond the capacity. The mutex must be held.
+     * @param key a key
+     * @param source the input, if kept in memory
+     * @param result the result, if kept in memory
+     * @return the files of the evicted entries, for the caller to remove
+     * once it releases the mutex.
+     */
+    std::vector<std::string> Insert(const std::string &key, const Matrix &source,
+                                    const Matrix &result) noexcept(false);
+
+public:
+
+    /**
+     * Constructs a cache which keeps up to capacity results in memory.
+     * @param capacity the maximal number of results (positive)
+     */
+    explicit FilterCache(size_t capacity) noexcept(false);
+
+    /**
+     * Constructs a cache which keeps up to capacity results as files in the
+     * given directory, which is created if needed.
+     * @param capacity the maximal number of results (positive)
+     * @param directory path to a local directory
+     */
+    FilterCache(size_t capacity, const std::string &directory) noexcept(false);
+
+    FilterCache(const FilterCache &cache) = delete;
+
+    FilterCache& operator=(const FilterCache &cache) = delete;
+
+    /**
+     * Returns the stored result of the filter on the image, or computes and
+     * stores it.
+     * @param filter the name of the filter (letters, digits and '-' only)
+     * @param parameter the parameter of the filter (0 if it has none)
+     * @param image a matrix
+     * @param compute computes the result of the filter on the image
+     * @return the result of the filter on the image
+     */
+    Matrix Apply(const std::string &filter, int parameter, const Matrix &image,
+                 const std::function<Matrix(const Matrix&)> &compute) noexcept(false);
+
+    /**
+     * @param image a matrix
+     * @return Blur(image), from the cache if possible.
+     */
+    Matrix Blur(const Matrix &image) noexcept(false);
+
+    /**
+     * @param image a matrix
+     * @return Sobel(image), from the cache if possible.
+     */
+    Matrix Sobel(const Matrix &image) noexcept(false);
+
+    /**
+     * @param image a matrix
+     * @param levels an integer
+     * @param mode the way the bounds of the levels are chosen
+     * @return Quantization(image, levels, mode), from the cache if possible.
+     */
+    Matrix Quantization(const Matrix &image, int levels,
+                        QuantizationMode mode = QuantizationMode::UNIFORM) noexcept(false);
+
+    /**
+     * @return the amount of calls which were answered from the cache.
+     */
+    long GetHits() const noexcept;
+
+    /**
+     * @return the amount of calls which computed their result.
+     */
+    long GetMisses() const noexcept;
+};
+
+#endif //SOL_FILTER_CACHE_H
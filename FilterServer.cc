@@ -0,0 +1,573 @@
+#include "FilterServer.h"
+
+#ifdef FILTER_SERVER_SUPPORTED
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <utility>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Filters.h"
+#include "MatrixException.h"
+#include "ThreadPool.h"
+
+#define SOCKET_ERROR "Error opening the socket.\n"
+#define CONNECT_ERROR "Error connecting to the filter server.\n"
+#define REQUEST_ERROR "Invalid request.\n"
+#define RESPONSE_ERROR "Invalid response.\n"
+
+// Requests with a longer line, or with more pixels, are rejected
+#define MAX_HEADER 4096
+#define MAX_PIXELS (1L << 22)
+
+// A connection isn't read while it has this many bytes waiting, which is
+// the size of the largest request
+#define MAX_INPUT (MAX_HEADER + 1 + 4 * (size_t)MAX_PIXELS)
+
+// Only the owner of the server may connect to it
+#define SOCKET_MODE 0600
+
+#define RECEIVE_CHUNK 65536
+#define MAX_EVENTS 64
+
+// The epoll data of the listening socket and of the eventfd, connections
+// are numbered from 1
+#define LISTEN_EVENT 0
+#define WAKE_EVENT UINT64_MAX
+
+// -------- Static (helper) functions --------
+
+/**
+ * Closes a file descriptor when it goes out of scope.
+ */
+struct Descriptor {
+    int fd;
+    ~Descriptor(){
+        if (fd >= 0){
+            close(fd);
+        }
+    }
+};
+
+/**
+ * @param path the path of a socket
+ * @return the address of the socket.
+ */
+static sockaddr_un AddressOf(const std::string &path){
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)){
+        throw MatrixException(SOCKET_ERROR);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+/**
+ * Appends the elements of the matrix as 32 bit little endian floats.
+ */
+static void AppendPixels(std::string &out, const Matrix &image){
+    size_t start = out.size();
+    out.resize(start + (size_t)image.GetRows() * image.GetCols() * 4);
+    auto *bytes = (unsigned char *)&out[start];
+    for (int i = 0; i < image.GetRows(); i++){
+        const float *row = image.Row(i);
+        for (int j = 0; j < image.GetCols(); j++){
+            uint32_t bits;
+            std::memcpy(&bits, &row[j], sizeof(bits));
+            for (int b = 0; b < 4; b++){
+                *bytes++ = (unsigned char)(bits >> (8 * b));
+            }
+        }
+    }
+}
+
+/**
+ * @param pixels rows * cols 32 bit little endian floats
+ * @return a new matrix with the floats.
+ */
+static Matrix PixelsToMatrix(const char *pixels, int rows, int cols){
+    Matrix image(rows, cols);
+    auto *bytes = (const unsigned char *)pixels;
+    for (int i = 0; i < rows; i++){
+        float *row = image.Row(i);
+        for (int j = 0; j < cols; j++){
+            uint32_t bits = 0;
+            for (int b = 0; b < 4; b++){
+                bits |= (uint32_t)*bytes++ << (8 * b);
+            }
+            std::memcpy(&row[j], &bits, sizeof(bits));
+        }
+    }
+    return image;
+}
+
+/**
+ * Parses the line of a request.
+ * @param chain set to the chain of filters
+ * @param rows set to the rows of the image
+ * @param cols set to the columns of the image
+ * @return true if the line is valid, false otherwise
+ */
+static bool ParseHeader(const std::string &header, std::string &chain, int &rows, int &cols){
+    std::istringstream line(header);
+    std::string rest;
+    if (!(line >> chain >> rows >> cols) || (line >> rest)){
+        return false;
+    }
+    return rows > 0 && cols > 0 && (long)rows * cols <= MAX_PIXELS;
+}
+
+/**
+ * Tells whether a server answers on a socket.
+ * @param path the path of the socket
+ * @return false if nothing listens on it (the socket was left by a server
+ * which is gone), true otherwise, including when it can't be told.
+ */
+static bool IsListening(const std::string &path){
+    sockaddr_un address = AddressOf(path);
+    Descriptor probe = {socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    if (probe.fd < 0){
+        return true;
+    }
+    return connect(probe.fd, (sockaddr *)&address, sizeof(address)) == 0 || errno != ECONNREFUSED;
+}
+
+/**
+ * @param chain filters separated by commas, as "quant:4,blur"
+ * @return the name and the parameter (-1 if none) of every filter.
+ */
+static std::vector<std::pair<std::string, int>> ParseChain(const std::string &chain){
+    std::vector<std::pair<std::string, int>> filters;
+    std::istringstream steps(chain);
+    std::string step;
+    while (std::getline(steps, step, ',')){
+        size_t colon = step.find(':');
+        std::string name = step.substr(0, colon);
+        int parameter = -1;
+        if (colon != std::string::npos){
+            std::istringstream value(step.substr(colon + 1));
+            if (!(value >> parameter) || !value.eof()){
+                throw MatrixException(REQUEST_ERROR);
+            }
+        }
+        if (!IsFilter(name)){
+            throw MatrixException(REQUEST_ERROR);
+        }
+        filters.emplace_back(name, parameter);
+    }
+    if (filters.empty()){
+        throw MatrixException(REQUEST_ERROR);
+    }
+    return filters;
+}
+
+/**
+ * @return an error response with the message.
+ */
+static std::string ErrorResponse(std::string message){
+    while (!message.empty() && message.back() == '\n'){
+        message.pop_back();
+    }
+    return "ERROR " + message + "\n";
+}
+
+// -------- End of static functions --------
+
+// -------- Private functions --------
+
+void FilterServer::Accept() noexcept(false) {
+    while (true){
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0){
+            // EAGAIN when there are no more, other errors (such as being out
+            // of descriptors) wait for the next event
+            return;
+        }
+        uint64_t id = next_id_++;
+        Connection &connection = connections_[id];
+        connection.fd = fd;
+        ids_[fd] = id;
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = id;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0){
+            Close(id);
+            continue;
+        }
+        connection.events = EPOLLIN;
+    }
+}
+
+void FilterServer::Receive(uint64_t id) noexcept(false) {
+    Connection &connection = connections_.at(id);
+    while (true){
+        // Past the limit the rest stays in the socket, until the requests
+        // which are waiting are taken
+        size_t waiting = connection.input.size() - connection.input_pos;
+        if (waiting >= MAX_INPUT){
+            break;
+        }
+        size_t chunk = std::min((size_t)RECEIVE_CHUNK, MAX_INPUT - waiting);
+        size_t size = connection.input.size();
+        connection.input.resize(size + chunk);
+        ssize_t n = recv(connection.fd, &connection.input[size], chunk, 0);
+        int error = errno;
+        connection.input.resize(size + (n > 0 ? n : 0));
+        if (n > 0){
+            continue;
+        }
+        if (n == 0){
+            connection.closing = true;
+            break;
+        }
+        if (error == EINTR){
+            continue;
+        }
+        if (error == EAGAIN || error == EWOULDBLOCK){
+            break;
+        }
+        Close(id);
+        return;
+    }
+    Dispatch(id);
+    Send(id);
+}
+
+void FilterServer::Send(uint64_t id) noexcept(false) {
+    Connection &connection = connections_.at(id);
+    while (connection.output_pos < connection.output.size()){
+        ssize_t n = send(connection.fd, connection.output.data() + connection.output_pos,
+                         connection.output.size() - connection.output_pos, MSG_NOSIGNAL);
+        if (n > 0){
+            connection.output_pos += n;
+        }
+        else if (n < 0 && errno == EINTR){
+            continue;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            break;
+        }
+        else{
+            Close(id);
+            return;
+        }
+    }
+    if (connection.output_pos == connection.output.size()){
+        // The buffer keeps its capacity for the next response
+        connection.output.clear();
+        connection.output_pos = 0;
+        if (connection.closing && !connection.busy){
+            Close(id);
+            return;
+        }
+    }
+    if (!Watch(connection)){
+        Close(id);
+    }
+}
+
+void FilterServer::Dispatch(uint64_t id) noexcept(false) {
+    Connection &connection = connections_.at(id);
+    if (connection.busy){
+        return;
+    }
+    std::string &input = connection.input;
+    size_t end = input.find('\n', connection.input_pos);
+    if (end == std::string::npos){
+        if (input.size() - connection.input_pos > MAX_HEADER){
+            connection.output += ErrorResponse(REQUEST_ERROR);
+            connection.closing = true;
+        }
+        return;
+    }
+
+    // The length of a request is known once its line is, a line which
+    // can't be parsed leaves the rest of the stream meaningless
+    std::string header = input.substr(connection.input_pos, end - connection.input_pos);
+    std::string chain;
+    int rows;
+    int cols;
+    if (header.size() > MAX_HEADER || !ParseHeader(header, chain, rows, cols)){
+        connection.output += ErrorResponse(REQUEST_ERROR);
+        connection.closing = true;
+        return;
+    }
+    size_t size = (size_t)rows * cols * 4;
+    if (input.size() - (end + 1) < size){
+        return;
+    }
+    std::string pixels = input.substr(end + 1, size);
+    connection.input_pos = end + 1 + size;
+    if (connection.input_pos == input.size()){
+        input.clear();
+        connection.input_pos = 0;
+    }
+    else if (connection.input_pos > input.size() / 2){
+        input.erase(0, connection.input_pos);
+        connection.input_pos = 0;
+    }
+
+    connection.busy = true;
+    {
+        std::lock_guard<std::mutex> lock(done_mutex_);
+        in_flight_++;
+    }
+    ThreadPool::Shared().Submit([this, id, header = std::move(header), pixels = std::move(pixels)]{
+        std::string response = Serve(header, pixels);
+        uint64_t one = 1;
+        std::lock_guard<std::mutex> lock(done_mutex_);
+        done_.push_back({id, std::move(response)});
+        if (write(wake_fd_, &one, sizeof(one)) < 0){
+            // The counter is saturated, the loop wakes up anyway
+        }
+        in_flight_--;
+        idle_.notify_all();
+    });
+}
+
+void FilterServer::Complete() noexcept(false) {
+    uint64_t count;
+    if (read(wake_fd_, &count, sizeof(count)) < 0){
+        // Nothing to read, EAGAIN
+    }
+    std::vector<Completion> done;
+    {
+        std::lock_guard<std::mutex> lock(done_mutex_);
+        done.swap(done_);
+    }
+    for (Completion &completion : done){
+        auto it = connections_.find(completion.connection);
+        if (it == connections_.end()){
+            continue;
+        }
+        it->second.output += completion.response;
+        it->second.busy = false;
+        Dispatch(completion.connection);
+        Send(completion.connection);
+    }
+}
+
+bool FilterServer::Watch(Connection &connection) noexcept {
+    uint32_t events = 0;
+    if (!connection.closing && connection.input.size() - connection.input_pos < MAX_INPUT){
+        events |= EPOLLIN;
+    }
+    if (connection.output_pos < connection.output.size()){
+        events |= EPOLLOUT;
+    }
+    if (events != connection.events){
+        epoll_event event = {};
+        event.events = events;
+        event.data.u64 = ids_.at(connection.fd);
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event) < 0){
+            return false;
+        }
+        connection.events = events;
+    }
+    return true;
+}
+
+void FilterServer::Close(uint64_t id) noexcept {
+    auto it = connections_.find(id);
+    if (it == connections_.end()){
+        return;
+    }
+    int fd = it->second.fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    ids_.erase(fd);
+    connections_.erase(it);
+}
+
+std::string FilterServer::Serve(const std::string &header, const std::string &pixels) noexcept {
+    try{
+        std::string chain;
+        int rows;
+        int cols;
+        ParseHeader(header, chain, rows, cols);
+        std::vector<std::pair<std::string, int>> filters = ParseChain(chain);
+        Matrix image = PixelsToMatrix(pixels.data(), rows, cols);
+
+        for (const auto &filter : filters){
+            const std::string &name = filter.first;
+            int parameter = filter.second;
+            image = cache_.Apply(name, parameter, image, [&](const Matrix &m){
+                return ApplyFilter(name, m, parameter);
+            });
+        }
+
+        std::string response = "OK " + std::to_string(image.GetRows()) + " " +
+                               std::to_string(image.GetCols()) + "\n";
+        AppendPixels(response, image);
+        return response;
+
+    } catch (const std::exception &e) {
+        return ErrorResponse(e.what());
+    }
+}
+
+// -------- End of private functions --------
+
+FilterServer::FilterServer(const std::string &path) noexcept(false) : path_(path), cache_(SERVER_CACHE_ENTRIES) {
+    sockaddr_un address = AddressOf(path);
+    Descriptor listener = {socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)};
+    Descriptor poller = {epoll_create1(EPOLL_CLOEXEC)};
+    Descriptor waker = {eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)};
+    if (listener.fd < 0 || poller.fd < 0 || waker.fd < 0){
+        throw MatrixException(SOCKET_ERROR);
+    }
+
+    // Replace a socket left by a server which is gone, but never the socket
+    // of a running server, nor another file
+    struct stat info = {};
+    if (stat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode) && !IsListening(path)){
+        unlink(path.c_str());
+    }
+    if (bind(listener.fd, (sockaddr *)&address, sizeof(address)) < 0){
+        throw MatrixException(SOCKET_ERROR);
+    }
+
+    // Nobody can connect before listen, so the mode is set in time
+    bool listening = chmod(path.c_str(), SOCKET_MODE) == 0 && listen(listener.fd, SOMAXCONN) == 0;
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = LISTEN_EVENT;
+    listening = listening && epoll_ctl(poller.fd, EPOLL_CTL_ADD, listener.fd, &event) == 0;
+    event.data.u64 = WAKE_EVENT;
+    listening = listening && epoll_ctl(poller.fd, EPOLL_CTL_ADD, waker.fd, &event) == 0;
+    if (!listening){
+        unlink(path.c_str());
+        throw MatrixException(SOCKET_ERROR);
+    }
+
+    std::swap(listen_fd_, listener.fd);
+    std::swap(epoll_fd_, poller.fd);
+    std::swap(wake_fd_, waker.fd);
+}
+
+void FilterServer::Run() noexcept(false) {
+    epoll_event events[MAX_EVENTS];
+    while (!stopping_){
+        int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+        if (n < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            throw MatrixException(SOCKET_ERROR);
+        }
+        for (int e = 0; e < n; e++){
+            uint64_t id = events[e].data.u64;
+            uint32_t flags = events[e].events;
+            if (id == LISTEN_EVENT){
+                Accept();
+                continue;
+            }
+            if (id == WAKE_EVENT){
+                Complete();
+                continue;
+            }
+            // Earlier events of this round may have closed the connection
+            if (flags & EPOLLIN && connections_.count(id)){
+                Receive(id);
+            }
+            if (flags & EPOLLOUT && connections_.count(id)){
+                Send(id);
+            }
+            if (flags & (EPOLLHUP | EPOLLERR)){
+                Close(id);
+            }
+        }
+    }
+}
+
+void FilterServer::Stop() noexcept {
+    stopping_ = true;
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0){
+        // The counter is saturated, the loop wakes up anyway
+    }
+}
+
+FilterServer::~FilterServer() noexcept {
+    {
+        std::unique_lock<std::mutex> lock(done_mutex_);
+        idle_.wait(lock, [this]{ return in_flight_ == 0; });
+    }
+    while (!connections_.empty()){
+        Close(connections_.begin()->first);
+    }
+    close(wake_fd_);
+    close(epoll_fd_);
+    close(listen_fd_);
+    unlink(path_.c_str());
+}
+
+Matrix RequestFilters(const std::string &path, const std::string &chain, const Matrix &image) noexcept(false) {
+    sockaddr_un address = AddressOf(path);
+    Descriptor server = {socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    if (server.fd < 0 || connect(server.fd, (sockaddr *)&address, sizeof(address)) < 0){
+        throw MatrixException(CONNECT_ERROR);
+    }
+
+    std::string request = chain + " " + std::to_string(image.GetRows()) + " " +
+                          std::to_string(image.GetCols()) + "\n";
+    AppendPixels(request, image);
+    size_t sent = 0;
+    while (sent < request.size()){
+        ssize_t n = send(server.fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR){
+            continue;
+        }
+        if (n <= 0){
+            throw MatrixException(CONNECT_ERROR);
+        }
+        sent += n;
+    }
+
+    // Read the line, then as many pixels as it announces
+    std::string response;
+    size_t end;
+    size_t needed = std::string::npos;
+    int rows = 0;
+    int cols = 0;
+    char buffer[RECEIVE_CHUNK];
+    while (true){
+        if (needed == std::string::npos && (end = response.find('\n')) != std::string::npos){
+            std::istringstream line(response.substr(0, end));
+            std::string status;
+            line >> status;
+            if (status == "ERROR"){
+                std::string message;
+                std::getline(line >> std::ws, message);
+                throw MatrixException(message + "\n");
+            }
+            if (status != "OK" || !(line >> rows >> cols) || rows <= 0 || cols <= 0 ||
+                (long)rows * cols > MAX_PIXELS){
+                throw MatrixException(RESPONSE_ERROR);
+            }
+            response.erase(0, end + 1);
+            needed = (size_t)rows * cols * 4;
+        }
+        if (needed != std::string::npos && response.size() >= needed){
+            break;
+        }
+        ssize_t n = recv(server.fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR){
+            continue;
+        }
+        if (n <= 0){
+            throw MatrixException(RESPONSE_ERROR);
+        }
+        response.append(buffer, n);
+    }
+    return PixelsToMatrix(response.data(), rows, cols);
+}
+
+#endif //FILTER_SERVER_SUPPORTED
@@ -0,0 +1,168 @@
+#ifndef SOL_FILTER_SERVER_H
+#define SOL_FILTER_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Matrix.h"
+#include "FilterCache.h"
+
+// The server runs an epoll event loop, which only Linux has. Elsewhere the
+// server isn't built, and the main program reports that it's unsupported
+#ifdef __linux__
+#define FILTER_SERVER_SUPPORTED
+#endif
+
+#ifdef FILTER_SERVER_SUPPORTED
+
+// The amount of results the server keeps for repeated requests
+#define SERVER_CACHE_ENTRIES 64
+
+/**
+ * A long lived filter service on a Unix domain socket, which saves the
+ * start up of a process per image and keeps the thread pool, the filter
+ * cache and the connection buffers warm between requests.
+ *
+ * Requests and responses are a text line and the pixels:
+ *   request:  "<chain> <rows> <cols>\n" and rows * cols floats
+ *   response: "OK <rows> <cols>\n" and rows * cols floats, or
+ *             "ERROR <message>\n"
+ * where the chain is filters separated by commas, each optionally with its
+ * parameter after a colon ("quant:4,blur"), and the floats are 32 bit,
+ * little endian, row after row. A connection may send any amount of
+ * requests, and gets the responses in order. The socket is only open to
+ * the user who runs the server, and a request has at most 1 << 22 pixels.
+ *
+ * A single thread runs an epoll event loop (Linux) over non blocking
+ * sockets, and hands complete requests to the shared pool; finished
+ * responses are passed back to the loop through an eventfd. Requests of
+ * different connections are filtered concurrently.
+ */
+class FilterServer {
+
+private:
+
+    struct Connection {
+        int fd;
+        std::string input;  // received bytes, consumed from input_pos
+        size_t input_pos = 0;
+        std::string output;  // bytes to send, sent up to output_pos
+        size_t output_pos = 0;
+        bool busy = false;  // a request is being filtered
+        bool closing = false;  // the client is done sending
+        uint32_t events = 0;  // the events the loop waits for
+    };
+
+    struct Completion {
+        uint64_t connection;
+        std::string response;
+    };
+
+    std::string path_;
+    int listen_fd_ = -1;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    std::atomic<bool> stopping_{false};
+    uint64_t next_id_ = 1;
+    std::unordered_map<uint64_t, Connection> connections_;  // by id, fds are reused
+    std::unordered_map<int, uint64_t> ids_;  // connection id by fd
+    FilterCache cache_;
+
+    // Finished requests, handed from the pool to the loop
+    std::mutex done_mutex_;
+    std::condition_variable idle_;
+    std::vector<Completion> done_;
+    int in_flight_ = 0;
+
+    /**
+     * Accepts all pending connections.
+     */
+    void Accept() noexcept(false);
+
+    /**
+     * Reads what the connection sent and starts its next request.
+     */
+    void Receive(uint64_t id) noexcept(false);
+
+    /**
+     * Sends what the connection can take, and closes it once it's done.
+     */
+    void Send(uint64_t id) noexcept(false);
+
+    /**
+     * Starts the next complete request of the connection, unless one is
+     * being filtered already.
+     */
+    void Dispatch(uint64_t id) noexcept(false);
+
+    /**
+     * Moves the finished responses to their connections.
+     */
+    void Complete() noexcept(false);
+
+    /**
+     * Updates the events the loop waits for on the connection.
+     * @return false if the events couldn't be updated (the connection
+     * should be closed), true otherwise.
+     */
+    bool Watch(Connection &connection) noexcept;
+
+    /**
+     * Closes the connection and forgets it.
+     */
+    void Close(uint64_t id) noexcept;
+
+    /**
+     * Parses a request and runs its chain of filters.
+     * @param header the text line of the request, without the new line
+     * @param pixels the floats of the image
+     * @return the response.
+     */
+    std::string Serve(const std::string &header, const std::string &pixels) noexcept;
+
+public:
+
+    /**
+     * Binds the socket and listens on it. A socket file left at the path by
+     * a server which is gone is replaced, a running server is not.
+     * @param path the path of the socket
+     */
+    explicit FilterServer(const std::string &path) noexcept(false);
+
+    FilterServer(const FilterServer &server) = delete;
+
+    FilterServer& operator=(const FilterServer &server) = delete;
+
+    /**
+     * Serves requests until Stop is called.
+     */
+    void Run() noexcept(false);
+
+    /**
+     * Makes Run return, may be called from any thread or a signal handler.
+     */
+    void Stop() noexcept;
+
+    /**
+     * Waits for the requests which are being filtered, closes the
+     * connections and removes the socket file.
+     */
+    ~FilterServer() noexcept;
+};
+
+/**
+ * The client side: sends an image and a chain of filters to a server.
+ * @param path the path of the socket of the server
+ * @param chain filters separated by commas, as "quant:4,blur"
+ * @param image a matrix
+ * @return the result of the chain on the image.
+ */
+Matrix RequestFilters(const std::string &path, const std::string &chain, const Matrix &image) noexcept(false);
+
+#endif //FILTER_SERVER_SUPPORTED
+
+#endif //SOL_FILTER_SERVER_H
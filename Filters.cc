@@ -1,26 +1,84 @@
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <cmath>
+#include <cstdint>
+#include <functional>
+#include <vector>
 #include "Filters.h"
+#include "Histogram.h"
+#include "MatrixException.h"
+#include "ThreadPool.h"
 
-#define NUM_SHADES 256
+#define LEVELS_ERROR "Invalid number of levels.\n"
+#define DIMENSION_ERROR "Invalid matrix dimensions.\n"
+#define TILE_ERROR "Invalid tile size.\n"
+#define RADIUS_ERROR "Invalid filter radius.\n"
+#define PERCENTILE_ERROR "Invalid percentile.\n"
+#define OPERATOR_ERROR "Invalid operator selected.\n"
+
+// Rank filters keep a coarse histogram of NUM_SHADES / FINE_BINS buckets
+// next to the fine one, and search the coarse one first
+#define FINE_BINS 16
+#define COARSE_BINS (NUM_SHADES / FINE_BINS)
+
+// Column histograms count up to 2 * radius + 1 pixels in 16 bits
+#define MAX_RANK_RADIUS 32767
+#define KMEANS_MAX_ITERATIONS 64
+
+/**
+ * Prefix sums over the bins of an 8-bit histogram, which give the
+ * weight, mean and scatter of any range of shades [lo, hi) in O(1).
+ */
+struct ShadePrefix {
+    double count[NUM_SHADES + 1];
+    double sum[NUM_SHADES + 1];
+    double squares[NUM_SHADES + 1];
+};
+
+/**
+ * A range of shades [lo, hi) which is mapped to a single colour, along with
+ * the shade it would be split at (-1 if it can't be split) and the priority
+ * of that split.
+ */
+struct ShadeRange {
+    int lo;
+    int hi;
+    int split;
+    double priority;
+};
 
 // -------- Static (helper) functions --------
+/**
+ * @param value a float
+ * @return zero if the value is less then zero, 255 if it's greater
+ * then 255, and the value otherwise.
+ */
+static float ClampShade(float value){
+    if (value < 0){
+        return 0;
+    }
+    if (value >= NUM_SHADES){
+        return NUM_SHADES - 1;
+    }
+    return value;
+}
+
 /**
  * The program updates every cell in the matrix to zero if it's
  * less then zero, and 255 if it's greater then 255.
  * @param image a matrix
  */
 static void Update(Matrix& image){
-    for (int i = 0; i < image.GetRows() * image.GetCols(); i ++){
-        if (image[i] < 0){
-            image[i] = 0;
-        }
-        else{
-            if (image[i] >= NUM_SHADES){
-                image[i] = NUM_SHADES - 1;
+    int cols = image.GetCols();
+    ParallelRows(image.GetRows(), cols, [&](int first, int last){
+        for (int i = first; i < last; i ++){
+            float *row = image.Row(i);
+            for (int j = 0; j < cols; j ++){
+                row[j] = ClampShade(row[j]);
             }
         }
-    }
+    });
 }
 
 /**
@@ -33,6 +91,102 @@ static float AverageFloor(float a, float b){
     return std::floor((a + b) / 2);
 }
 
+/**
+ *
+ * @param image a matrix to operate a convolution on
+ * @param conv a 3 x 3 convolution matrix
+ * @param i the row of the pixel
+ * @param j the column of the pixel
+ * @return the value of the convolution of the given matrices at the
+ * pixel (i, j), rounded to the nearest integer.
+ */
+static float ConvolvePixel(const Matrix& image, const Matrix& conv, int i, int j){
+    if (i == 0) {  // first row of the image matrix
+        if (j == 0){  // first column of the image matrix
+            return std::rintf(image(i, j) * conv[4]
+                      + image(i, j + 1) * conv[5]
+                      + image(i + 1, j) * conv[7]
+                      + image(i + 1, j + 1) * conv[8]);
+        }
+        else{
+            if (j == image.GetCols() - 1){  // last column of the image matrix
+                return std::rintf(image(i, j - 1) * conv[3]
+                          + image(i, j) * conv[4]
+                          + image(i + 1, j - 1) * conv[6]
+                          + image(i + 1, j) * conv[7]);
+            }
+            else{  // any column other then the first and the last one
+                return std::rintf(image(i, j - 1) * conv[3]
+                          + image(i, j) * conv[4]
+                          + image(i, j + 1) * conv[5]
+                          + image(i + 1, j - 1) * conv[6]
+                          + image(i + 1, j) * conv[7]
+                          + image(i + 1, j + 1) * conv[8]);
+            }
+        }
+
+    }
+    else{
+        if (j == 0){  // first column of the image matrix
+            if (i == image.GetRows() - 1){  // last row of the image matrix
+                return std::rintf(image(i - 1, j) * conv[1]
+                          + image(i - 1, j + 1) * conv[2]
+                          + image(i, j) * conv[4]
+                          + image(i, j + 1) * conv[5]);
+            }
+            else{  // any row other then the first and the last one
+                return std::rintf(image(i - 1, j) * conv[1]
+                          + image(i - 1, j + 1) * conv[2]
+                          + image(i, j) * conv[4]
+                          + image(i, j + 1) * conv[5]
+                          + image(i + 1, j) * conv[7]
+                          + image(i + 1, j + 1) * conv[8]);
+            }
+        }
+        else{
+            if (i == image.GetRows() - 1){  // last row of the image matrix
+                if (j == image.GetCols() - 1){  // last column of the image matrix
+                    return std::rintf(image(i - 1, j - 1) * conv[0]
+                              + image(i - 1, j) * conv[1]
+                              + image(i, j - 1) * conv[3]
+                              + image(i, j) * conv[4]);
+                }
+                else{  // // any column other then the first and the last one
+                    return std::rintf(image(i - 1, j - 1) * conv[0]
+                              + image(i - 1, j) * conv[1]
+                              + image(i - 1, j + 1) * conv[2]
+                              + image(i, j - 1) * conv[3]
+                              + image(i, j) * conv[4]
+                              + image(i, j + 1) * conv[5]);
+                }
+            }
+            else{
+                if (j == image.GetCols() - 1){  // last column of the image matrix
+                    // already dealt with first row and last row,
+                    // only left to deal with any row other then last and first
+                    return std::rintf(image(i - 1, j - 1) * conv[0]
+                              + image(i - 1, j) * conv[1]
+                              + image(i, j - 1) * conv[3]
+                              + image(i, j) * conv[4]
+                              + image(i + 1, j - 1) * conv[6]
+                              + image(i + 1, j) * conv[7]);
+                }
+                else{  // we're not in the edges of the image matrix
+                    return std::rintf(image(i - 1, j - 1) * conv[0]
+                              + image(i - 1, j) * conv[1]
+                              + image(i - 1, j + 1) * conv[2]
+                              + image(i, j - 1) * conv[3]
+                              + image(i, j) * conv[4]
+                              + image(i, j + 1) * conv[5]
+                              + image(i + 1, j - 1) * conv[6]
+                              + image(i + 1, j) * conv[7]
+                              + image(i + 1, j + 1) * conv[8]);
+                }
+            }
+        }
+    }
+}
+
 /**
  *
  * @param m a matrix to operate a convolution on
@@ -43,95 +197,442 @@ static Matrix Convolution(const Matrix& image, const Matrix& conv){
     // Construct a new matrix
     auto res = Matrix(image.GetRows(), image.GetCols());
 
-    for (int i = 0; i < image.GetRows(); i++){
-        for (int j = 0; j < image.GetCols(); j ++){
-            if (i == 0) {  // first row of the image matrix
-                if (j == 0){  // first column of the image matrix
-                    res(i, j) = std::rintf(image(i, j) * conv[4]
-                                   + image(i, j + 1) * conv[5]
-                                   + image(i + 1, j) * conv[7]
-                                   + image(i + 1, j + 1) * conv[8]);
-                }
-                else{
-                    if (j == image.GetCols() - 1){  // last column of the image matrix
-                        res(i, j) = std::rintf(image(i, j - 1) * conv[3]
-                                       + image(i, j) * conv[4]
-                                       + image(i + 1, j - 1) * conv[6]
-                                       + image(i + 1, j) * conv[7]);
-                    }
-                    else{  // any column other then the first and the last one
-                        res(i, j) = std::rintf(image(i, j - 1) * conv[3]
-                                       + image(i, j) * conv[4]
-                                       + image(i, j + 1) * conv[5]
-                                       + image(i + 1, j - 1) * conv[6]
-                                       + image(i + 1, j) * conv[7]
-                                       + image(i + 1, j + 1) * conv[8]);
-                    }
-                }
+    // Every row of the result only depends on the image, so the rows are
+    // computed in parallel bands.
+    ParallelRows(image.GetRows(), image.GetCols(), [&](int first, int last){
+        for (int i = first; i < last; i++){
+            float *row = res.Row(i);
+            for (int j = 0; j < image.GetCols(); j ++){
+                row[j] = ConvolvePixel(image, conv, i, j);
+            }
+        }
+    });
+    return res;
+}
 
+/**
+ * @return the 3 x 3 convolution matrix of the gaussian blur.
+ */
+static Matrix BlurKernel(){
+    Matrix conv(3, 3);
+
+    // Creating the convolution matrix:
+    // [1 2 1]
+    // [2 4 2] * (1/16)
+    // [1 2 1]
+    conv[0] = conv[2] = conv[6] = conv[8] = 1;
+    conv[4] = 4;
+    conv[1] = conv[3] = conv[5] = conv[7] = 2;
+    conv *= 0.0625;
+
+    return conv;
+}
+
+/**
+ * @return the 3 x 3 convolution matrix of the horizontal sobel gradient.
+ */
+static Matrix SobelKernelX(){
+    Matrix conv_gx(3, 3);
+
+    // Creating the G_x convolution matrix:
+    // [1 0 -1]
+    // [2 0 -2] * (1/8)
+    // [1 0 -1]
+    conv_gx[0] = conv_gx[6] = 1;
+    conv_gx[2] = conv_gx[8] = -1;
+    conv_gx[3] = 2;
+    conv_gx[5] = -2;
+    conv_gx *= 0.125;
+
+    return conv_gx;
+}
+
+/**
+ * @return the 3 x 3 convolution matrix of the vertical sobel gradient.
+ */
+static Matrix SobelKernelY(){
+    Matrix conv_gy(3, 3);
+
+    // Creating the G_y convolution matrix:
+    // [1   2  1]
+    // [0   0  0] * (1/8)
+    // [-1 -2 -1]
+    conv_gy[0] = conv_gy[2] = 1;
+    conv_gy[1] = 2;
+    conv_gy[6] = conv_gy[8] = -1;
+    conv_gy[7] = -2;
+    conv_gy *= 0.125;
+
+    return conv_gy;
+}
+
+/**
+ * @return true if the pixels of the two images differ anywhere in the
+ * rows [r0, r1) and the columns [c0, c1).
+ */
+static bool RegionChanged(const Matrix& before, const Matrix& after,
+                          int r0, int r1, int c0, int c1){
+    for (int i = r0; i < r1; i++){
+        const float *a = before.Row(i);
+        const float *b = after.Row(i);
+        for (int j = c0; j < c1; j++){
+            if (a[j] != b[j]){
+                return true;
             }
-            else{
-                if (j == 0){  // first column of the image matrix
-                    if (i == image.GetRows() - 1){  // last row of the image matrix
-                        res(i, j) = std::rintf(image(i - 1, j) * conv[1]
-                                       + image(i - 1, j + 1) * conv[2]
-                                       + image(i, j) * conv[4]
-                                       + image(i, j + 1) * conv[5]);
-                    }
-                    else{  // any row other then the first and the last one
-                        res(i, j) = std::rintf(image(i - 1, j) * conv[1]
-                                       + image(i - 1, j + 1) * conv[2]
-                                       + image(i, j) * conv[4]
-                                       + image(i, j + 1) * conv[5]
-                                       + image(i + 1, j) * conv[7]
-                                       + image(i + 1, j + 1) * conv[8]);
-                    }
+        }
+    }
+    return false;
+}
+
+/**
+ * Recomputes the tiles of the previous result whose pixels depend on
+ * pixels which changed between the previous image and the image. A pixel
+ * of the result depends on its 3 x 3 neighbourhood, so a tile is
+ * recomputed when the tile grown by a 1 pixel halo changed. Tiles never
+ * overlap, so they are recomputed in parallel.
+ * @param prev_image the image of the previous frame
+ * @param image the image of the current frame
+ * @param prev_result the result of the previous frame, patched in place
+ * @param tile the side of a tile
+ * @param pixel computes a pixel of the result from the image
+ * @return the amount of tiles which were recomputed.
+ */
+static int RefilterChangedTiles(const Matrix& prev_image, const Matrix& image,
+                                Matrix& prev_result, int tile,
+                                const std::function<float(const Matrix&, int, int)>& pixel){
+    int rows = image.GetRows();
+    int cols = image.GetCols();
+    if (prev_image.GetRows() != rows || prev_image.GetCols() != cols
+        || prev_result.GetRows() != rows || prev_result.GetCols() != cols){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    if (tile <= 0){
+        throw MatrixException(TILE_ERROR);
+    }
+
+    int tile_rows = (rows + tile - 1) / tile;
+    int tile_cols = (cols + tile - 1) / tile;
+    std::atomic<int> recomputed(0);
+
+    auto refilter = [&](int first, int last){
+        for (int t = first; t < last; t++){
+            int r0 = (t / tile_cols) * tile;
+            int c0 = (t % tile_cols) * tile;
+            int r1 = std::min(r0 + tile, rows);
+            int c1 = std::min(c0 + tile, cols);
+            if (!RegionChanged(prev_image, image, std::max(r0 - 1, 0), std::min(r1 + 1, rows),
+                               std::max(c0 - 1, 0), std::min(c1 + 1, cols))){
+                continue;
+            }
+            for (int i = r0; i < r1; i++){
+                float *row = prev_result.Row(i);
+                for (int j = c0; j < c1; j++){
+                    row[j] = pixel(image, i, j);
                 }
-                else{
-                    if (i == image.GetRows() - 1){  // last row of the image matrix
-                        if (j == image.GetCols() - 1){  // last column of the image matrix
-                            res(i, j) = std::rintf(image(i - 1, j - 1) * conv[0]
-                                           + image(i - 1, j) * conv[1]
-                                           + image(i, j - 1) * conv[3]
-                                           + image(i, j) * conv[4]);
-                        }
-                        else{  // // any column other then the first and the last one
-                            res(i, j) = std::rintf(image(i - 1, j - 1) * conv[0]
-                                           + image(i - 1, j) * conv[1]
-                                           + image(i - 1, j + 1) * conv[2]
-                                           + image(i, j - 1) * conv[3]
-                                           + image(i, j) * conv[4]
-                                           + image(i, j + 1) * conv[5]);
-                        }
-                    }
-                    else{
-                        if (j == image.GetCols() - 1){  // last column of the image matrix
-                            // already dealt with first row and last row,
-                            // only left to deal with any row other then last and first
-                            res(i, j) = std::rintf(image(i - 1, j - 1) * conv[0]
-                                           + image(i - 1, j) * conv[1]
-                                           + image(i, j - 1) * conv[3]
-                                           + image(i, j) * conv[4]
-                                           + image(i + 1, j - 1) * conv[6]
-                                           + image(i + 1, j) * conv[7]);
-                        }
-                        else{  // we're not in the edges of the image matrix
-                            res(i, j) = std::rintf(image(i - 1, j - 1) * conv[0]
-                                           + image(i - 1, j) * conv[1]
-                                           + image(i - 1, j + 1) * conv[2]
-                                           + image(i, j - 1) * conv[3]
-                                           + image(i, j) * conv[4]
-                                           + image(i, j + 1) * conv[5]
-                                           + image(i + 1, j - 1) * conv[6]
-                                           + image(i + 1, j) * conv[7]
-                                           + image(i + 1, j + 1) * conv[8]);
-                        }
-                    }
+            }
+            recomputed++;
+        }
+    };
+
+    if ((long)rows * cols < PARALLEL_MIN_ELEMENTS){
+        refilter(0, tile_rows * tile_cols);
+    }
+    else{
+        ThreadPool::Shared().ParallelFor(0, tile_rows * tile_cols, 1, refilter);
+    }
+    return recomputed;
+}
+
+/**
+ * @param value a float
+ * @return the 8-bit shade of the value, floored and clamped to [0, 255]
+ * (NaN counts as 0).
+ */
+static int ShadeOf(float value){
+    if (!(value >= 0)){
+        return 0;
+    }
+    if (value >= NUM_SHADES){
+        return NUM_SHADES - 1;
+    }
+    return (int)value;
+}
+
+/**
+ * Adds (sign 1) or removes (sign -1) one pixel of every column of the
+ * image row to the column histograms.
+ */
+static void UpdateColumns(const float *row, int cols, int sign,
+                          std::vector<uint16_t>& fine, std::vector<uint16_t>& coarse){
+    for (int c = 0; c < cols; c++){
+        int shade = ShadeOf(row[c]);
+        fine[(size_t)c * NUM_SHADES + shade] += sign;
+        coarse[(size_t)c * COARSE_BINS + shade / FINE_BINS] += sign;
+    }
+}
+
+/**
+ * Adds (sign 1) or removes (sign -1) a column histogram to the kernel
+ * histogram. These are fixed length loops over contiguous counters, which
+ * the compiler vectorizes.
+ */
+static void UpdateKernel(const uint16_t *fine, const uint16_t *coarse, int sign,
+                         uint32_t *kernel_fine, uint32_t *kernel_coarse){
+    for (int b = 0; b < NUM_SHADES; b++){
+        kernel_fine[b] += sign * fine[b];
+    }
+    for (int b = 0; b < COARSE_BINS; b++){
+        kernel_coarse[b] += sign * coarse[b];
+    }
+}
+
+/**
+ * Filters the rows [first, last) with the Perreault-Hebert algorithm: a
+ * histogram per column holds the 2r + 1 pixels of the column around the
+ * current row, and the histogram of the window slides along the row by
+ * removing one column histogram and adding another. The work per pixel
+ * is O(NUM_SHADES) whatever the radius, and finding the rank searches the
+ * coarse buckets before the fine bins of one bucket. The image borders
+ * are replicated.
+ * @param rank the index of the output value in the sorted window
+ */
+static void RankRows(const Matrix& image, Matrix& res, int radius, uint32_t rank,
+                     int first, int last){
+    int rows = image.GetRows();
+    int cols = image.GetCols();
+    auto clamp_row = [rows](int i){ return std::min(std::max(i, 0), rows - 1); };
+    auto clamp_col = [cols](int j){ return std::min(std::max(j, 0), cols - 1); };
+
+    std::vector<uint16_t> fine((size_t)cols * NUM_SHADES, 0);
+    std::vector<uint16_t> coarse((size_t)cols * COARSE_BINS, 0);
+    for (int k = -radius; k <= radius; k++){
+        UpdateColumns(image.Row(clamp_row(first + k)), cols, 1, fine, coarse);
+    }
+
+    uint32_t kernel_fine[NUM_SHADES];
+    uint32_t kernel_coarse[COARSE_BINS];
+    for (int i = first; i < last; i++){
+        if (i > first){
+            UpdateColumns(image.Row(clamp_row(i - 1 - radius)), cols, -1, fine, coarse);
+            UpdateColumns(image.Row(clamp_row(i + radius)), cols, 1, fine, coarse);
+        }
+
+        std::fill(kernel_fine, kernel_fine + NUM_SHADES, 0);
+        std::fill(kernel_coarse, kernel_coarse + COARSE_BINS, 0);
+        for (int d = -radius; d <= radius; d++){
+            size_t c = clamp_col(d);
+            UpdateKernel(&fine[c * NUM_SHADES], &coarse[c * COARSE_BINS], 1,
+                         kernel_fine, kernel_coarse);
+        }
+
+        float *out = res.Row(i);
+        for (int j = 0; j < cols; j++){
+            if (j > 0){
+                size_t removed = clamp_col(j - 1 - radius);
+                size_t added = clamp_col(j + radius);
+                if (removed != added){
+                    UpdateKernel(&fine[removed * NUM_SHADES], &coarse[removed * COARSE_BINS], -1,
+                                 kernel_fine, kernel_coarse);
+                    UpdateKernel(&fine[added * NUM_SHADES], &coarse[added * COARSE_BINS], 1,
+                                 kernel_fine, kernel_coarse);
                 }
             }
+
+            uint32_t seen = 0;
+            int bucket = 0;
+            while (seen + kernel_coarse[bucket] <= rank){
+                seen += kernel_coarse[bucket];
+                bucket++;
+            }
+            int shade = bucket * FINE_BINS;
+            while (seen + kernel_fine[shade] <= rank){
+                seen += kernel_fine[shade];
+                shade++;
+            }
+            out[j] = (float)shade;
+        }
+    }
+}
+
+/**
+ * Builds the prefix sums of the given 8-bit histogram.
+ * @param hist a histogram with NUM_SHADES bins
+ * @param prefix the prefix sums to fill
+ */
+static void BuildPrefix(const Histogram& hist, ShadePrefix& prefix){
+    prefix.count[0] = prefix.sum[0] = prefix.squares[0] = 0;
+    for (int b = 0; b < NUM_SHADES; b++){
+        double n = (double)hist[b];
+        prefix.count[b + 1] = prefix.count[b] + n;
+        prefix.sum[b + 1] = prefix.sum[b] + n * b;
+        prefix.squares[b + 1] = prefix.squares[b] + n * b * b;
+    }
+}
+
+/**
+ * @return the number of pixels whose shade is in [lo, hi)
+ */
+static double RangeCount(const ShadePrefix& p, int lo, int hi){
+    return p.count[hi] - p.count[lo];
+}
+
+/**
+ * @return the sum of the shades of the pixels in [lo, hi)
+ */
+static double RangeSum(const ShadePrefix& p, int lo, int hi){
+    return p.sum[hi] - p.sum[lo];
+}
+
+/**
+ * @return the sum of the squared distances of the shades in [lo, hi)
+ * from their mean (the variance times the count).
+ */
+static double RangeScatter(const ShadePrefix& p, int lo, int hi){
+    double n = RangeCount(p, lo, hi);
+    if (n == 0){
+        return 0;
+    }
+    double s = RangeSum(p, lo, hi);
+    return (p.squares[hi] - p.squares[lo]) - s * s / n;
+}
+
+/**
+ * @return the Otsu threshold of [lo, hi): the shade t which maximizes the
+ * between-class variance of [lo, t) and [t, hi), or -1 if the range has
+ * less than 2 distinct shades.
+ */
+static int OtsuSplit(const ShadePrefix& p, int lo, int hi){
+    int best = -1;
+    double best_variance = -1;
+    for (int t = lo + 1; t < hi; t++){
+        double w0 = RangeCount(p, lo, t);
+        double w1 = RangeCount(p, t, hi);
+        if (w0 == 0 || w1 == 0){
+            continue;
+        }
+        double diff = RangeSum(p, lo, t) / w0 - RangeSum(p, t, hi) / w1;
+        double variance = w0 * w1 * diff * diff;
+        if (variance > best_variance){
+            best_variance = variance;
+            best = t;
+        }
+    }
+    return best;
+}
+
+/**
+ * @return the shade t which divides the pixels of [lo, hi) into two
+ * non-empty halves as equal as possible, or -1 if the range has less
+ * than 2 distinct shades.
+ */
+static int MedianSplit(const ShadePrefix& p, int lo, int hi){
+    int best = -1;
+    double best_diff = 0;
+    for (int t = lo + 1; t < hi; t++){
+        double w0 = RangeCount(p, lo, t);
+        double w1 = RangeCount(p, t, hi);
+        if (w0 == 0 || w1 == 0){
+            continue;
+        }
+        double diff = std::fabs(w0 - w1);
+        if (best == -1 || diff < best_diff){
+            best_diff = diff;
+            best = t;
+        }
+    }
+    return best;
+}
+
+/**
+ * Computes the split of the given range according to the mode, and the
+ * priority of the split - ranges with a higher priority are split first.
+ * @param p the prefix sums of the histogram
+ * @param range the range to update
+ * @param mode OTSU splits the range with the largest scatter, any other
+ * mode splits the most populated range by its median.
+ */
+static void PlanSplit(const ShadePrefix& p, ShadeRange& range, QuantizationMode mode){
+    if (mode == QuantizationMode::OTSU){
+        range.split = OtsuSplit(p, range.lo, range.hi);
+        range.priority = RangeScatter(p, range.lo, range.hi);
+    }
+    else{
+        range.split = MedianSplit(p, range.lo, range.hi);
+        range.priority = RangeCount(p, range.lo, range.hi);
+    }
+}
+
+/**
+ * Divides the shades [0, NUM_SHADES) into at most the given number of
+ * ranges, by repeatedly splitting the range with the highest priority.
+ * Every range is planned once, so the total work is O(NUM_SHADES * depth).
+ * @return the ranges, ordered by their shades.
+ */
+static std::vector<ShadeRange> SplitRanges(const ShadePrefix& p, int levels,
+                                           QuantizationMode mode){
+    std::vector<ShadeRange> ranges(1);
+    ranges[0].lo = 0;
+    ranges[0].hi = NUM_SHADES;
+    PlanSplit(p, ranges[0], mode);
+
+    while ((int)ranges.size() < levels){
+        int chosen = -1;
+        for (int r = 0; r < (int)ranges.size(); r++){
+            if (ranges[r].split != -1 &&
+                (chosen == -1 || ranges[r].priority > ranges[chosen].priority)){
+                chosen = r;
+            }
+        }
+        if (chosen == -1){  // every range holds a single shade
+            break;
+        }
+
+        ShadeRange upper = ranges[chosen];
+        upper.lo = ranges[chosen].split;
+        ranges[chosen].hi = ranges[chosen].split;
+        PlanSplit(p, ranges[chosen], mode);
+        PlanSplit(p, upper, mode);
+        ranges.insert(ranges.begin() + chosen + 1, upper);
+    }
+    return ranges;
+}
+
+/**
+ * Refines the given ranges with Lloyd's k-means iterations on the
+ * histogram: every shade goes to its nearest centroid, and every centroid
+ * moves to the mean of its shades.
+ * @param p the prefix sums of the histogram
+ * @param ranges the ranges to refine, ordered by their shades
+ */
+static void KMeansRefine(const ShadePrefix& p, std::vector<ShadeRange>& ranges){
+    int k = (int)ranges.size();
+    std::vector<double> centroids(k);
+    for (int r = 0; r < k; r++){
+        centroids[r] = RangeSum(p, ranges[r].lo, ranges[r].hi)
+                       / RangeCount(p, ranges[r].lo, ranges[r].hi);
+    }
+
+    for (int iteration = 0; iteration < KMEANS_MAX_ITERATIONS; iteration++){
+        bool changed = false;
+        // In one dimension the nearest centroid of a shade changes at the
+        // midpoints between consecutive centroids.
+        for (int r = 1; r < k; r++){
+            int bound = (int)std::floor((centroids[r - 1] + centroids[r]) / 2) + 1;
+            if (bound != ranges[r].lo){
+                ranges[r].lo = ranges[r - 1].hi = bound;
+                changed = true;
+            }
+        }
+        if (!changed){
+            break;
+        }
+        for (int r = 0; r < k; r++){
+            double n = RangeCount(p, ranges[r].lo, ranges[r].hi);
+            if (n > 0){
+                centroids[r] = RangeSum(p, ranges[r].lo, ranges[r].hi) / n;
+            }
         }
     }
-    return res;
 }
 
 // -------- End of static functions --------
@@ -141,11 +642,15 @@ static Matrix Convolution(const Matrix& image, const Matrix& conv){
 /**
  *
  * @param image a matrix
- * @param levels an integer
+ * @param levels an integer, from 1 to NUM_SHADES
  * @return a new matrix which is the result of quantization on the
  * original matrix.
  */
 Matrix Quantization(const Matrix& image,int levels) {
+    if (levels <= 0 || levels > NUM_SHADES){
+        throw MatrixException(LEVELS_ERROR);
+    }
+
     // Number of colours
     int num_colours = NUM_SHADES / levels;
 
@@ -175,14 +680,21 @@ Matrix Quantization(const Matrix& image,int levels) {
             colours[i] = AverageFloor(lower[i], upper[i]);
         }
 
-        for (int i = 0; i < image.GetRows() * image.GetCols(); i ++){
-            for (int j = 0; j < levels; j ++){
-                if (image[i] < upper[j]){
-                    quant[i] = colours[j];
-                    break;
+        int cols = image.GetCols();
+        ParallelRows(image.GetRows(), cols, [&](int first, int last){
+            for (int i = first; i < last; i ++){
+                const float *in = image.Row(i);
+                float *out = quant.Row(i);
+                for (int k = 0; k < cols; k ++){
+                    for (int j = 0; j < levels; j ++){
+                        if (in[k] < upper[j]){
+                            out[k] = colours[j];
+                            break;
+                        }
+                    }
                 }
             }
-        }
+        });
 
         // Free the arrays
         delete[] colours;
@@ -201,16 +713,7 @@ Matrix Quantization(const Matrix& image,int levels) {
  * original matrix.
  */
 Matrix Blur(const Matrix& image) {
-    Matrix conv(3, 3);
-
-    // Creating the convolution matrix:
-    // [1 2 1]
-    // [2 4 2] * (1/16)
-    // [1 2 1]
-    conv[0] = conv[2] = conv[6] = conv[8] = 1;
-    conv[4] = 4;
-    conv[1] = conv[3] = conv[5] = conv[7] = 2;
-    conv *= 0.0625;
+    Matrix conv = BlurKernel();
 
     Matrix new_conv = Convolution(image, conv);
 
@@ -226,29 +729,8 @@ Matrix Blur(const Matrix& image) {
  * original matrix.
  */
 Matrix Sobel(const Matrix& image){
-    Matrix conv_gx(3, 3);
-
-    // Creating the G_x convolution matrix:
-    // [1 0 -1]
-    // [2 0 -2] * (1/8)
-    // [1 0 -1]
-    conv_gx[0] = conv_gx[6] = 1;
-    conv_gx[2] = conv_gx[8] = -1;
-    conv_gx[3] = 2;
-    conv_gx[5] = -2;
-    conv_gx *= 0.125;
-
-    Matrix conv_gy(3, 3);
-
-    // Creating the G_y convolution matrix:
-    // [1   2  1]
-    // [0   0  0] * (1/8)
-    // [-1 -2 -1]
-    conv_gy[0] = conv_gy[2] = 1;
-    conv_gy[1] = 2;
-    conv_gy[6] = conv_gy[8] = -1;
-    conv_gy[7] = -2;
-    conv_gy *= 0.125;
+    Matrix conv_gx = SobelKernelX();
+    Matrix conv_gy = SobelKernelY();
 
     Matrix sobel = Convolution(image, conv_gx) + Convolution(image, conv_gy);
 
@@ -257,3 +739,173 @@ Matrix Sobel(const Matrix& image){
 
     return sobel;
 }
+
+/**
+ *
+ * @param image a matrix
+ * @param levels an integer, from 1 to NUM_SHADES
+ * @param mode the way the bounds of the levels are chosen
+ * @return a new matrix which is the result of quantization on the
+ * original matrix. Adaptive modes scan the image once for its histogram,
+ * choose the levels in O(NUM_SHADES) work, and map every pixel through
+ * a lookup table; every level gets the rounded mean shade of its pixels.
+ */
+Matrix Quantization(const Matrix& image, int levels, QuantizationMode mode){
+    if (levels <= 0 || levels > NUM_SHADES){
+        throw MatrixException(LEVELS_ERROR);
+    }
+    if (mode == QuantizationMode::UNIFORM){
+        return Quantization(image, levels);
+    }
+
+    Histogram hist(image);
+    ShadePrefix prefix;
+    BuildPrefix(hist, prefix);
+
+    std::vector<ShadeRange> ranges = SplitRanges(prefix, levels, mode);
+    if (mode == QuantizationMode::KMEANS){
+        KMeansRefine(prefix, ranges);
+    }
+
+    // The colour of every shade
+    float lut[NUM_SHADES];
+    for (const ShadeRange &range : ranges){
+        double n = RangeCount(prefix, range.lo, range.hi);
+        float colour = n > 0 ? (float)std::rint(RangeSum(prefix, range.lo, range.hi) / n)
+                             : AverageFloor((float)range.lo, (float)range.hi - 1);
+        for (int b = range.lo; b < range.hi; b++){
+            lut[b] = colour;
+        }
+    }
+
+    Matrix quant(image.GetRows(), image.GetCols());
+    ParallelRows(image.GetRows(), image.GetCols(), [&](int first, int last){
+        for (int i = first; i < last; i++){
+            const float *in = image.Row(i);
+            float *out = quant.Row(i);
+            for (int j = 0; j < image.GetCols(); j++){
+                out[j] = lut[hist.BinOf(in[j])];
+            }
+        }
+    });
+
+    return quant;
+}
+
+/**
+ *
+ * @param prev_image the image of the previous frame
+ * @param image the image of the current frame
+ * @param prev_result Blur(prev_image), which is patched in place into
+ * Blur(image).
+ * @param tile the side of the tiles which are compared and recomputed
+ * @return the amount of tiles which were recomputed.
+ */
+int BlurIncremental(const Matrix& prev_image, const Matrix& image,
+                    Matrix& prev_result, int tile){
+    Matrix conv = BlurKernel();
+    return RefilterChangedTiles(prev_image, image, prev_result, tile,
+                                [&conv](const Matrix& m, int i, int j){
+        return ClampShade(ConvolvePixel(m, conv, i, j));
+    });
+}
+
+/**
+ *
+ * @param prev_image the image of the previous frame
+ * @param image the image of the current frame
+ * @param prev_result Sobel(prev_image), which is patched in place into
+ * Sobel(image).
+ * @param tile the side of the tiles which are compared and recomputed
+ * @return the amount of tiles which were recomputed.
+ */
+int SobelIncremental(const Matrix& prev_image, const Matrix& image,
+                     Matrix& prev_result, int tile){
+    Matrix conv_gx = SobelKernelX();
+    Matrix conv_gy = SobelKernelY();
+    return RefilterChangedTiles(prev_image, image, prev_result, tile,
+                                [&conv_gx, &conv_gy](const Matrix& m, int i, int j){
+        return ClampShade(ConvolvePixel(m, conv_gx, i, j) + ConvolvePixel(m, conv_gy, i, j));
+    });
+}
+
+/**
+ *
+ * @param image a matrix
+ * @param radius the window is (2 * radius + 1) x (2 * radius + 1)
+ * @return a new matrix which is the result of median filtering the
+ * original matrix.
+ */
+Matrix Median(const Matrix& image, int radius){
+    return RankFilter(image, radius, 0.5f);
+}
+
+/**
+ *
+ * @param image a matrix
+ * @param radius the window is (2 * radius + 1) x (2 * radius + 1)
+ * @param percentile the rank of the output in the window, from 0 (the
+ * minimum) through 0.5 (the median) to 1 (the maximum)
+ * @return a new matrix where every pixel is the given percentile of the
+ * 8-bit shades in its window. The cost per pixel doesn't depend on the
+ * radius.
+ */
+Matrix RankFilter(const Matrix& image, int radius, float percentile){
+    if (radius < 0 || radius > MAX_RANK_RADIUS){
+        throw MatrixException(RADIUS_ERROR);
+    }
+    if (!(percentile >= 0 && percentile <= 1)){
+        throw MatrixException(PERCENTILE_ERROR);
+    }
+
+    long side = 2L * radius + 1;
+    auto rank = (uint32_t)std::lround(percentile * (float)(side * side - 1));
+    Matrix res(image.GetRows(), image.GetCols());
+
+    // Every band builds its own column histograms, so the bands are few and
+    // large: one per thread.
+    int rows = image.GetRows();
+    long bands = ThreadPool::Shared().GetThreads() + 1;
+    if ((long)rows * image.GetCols() < PARALLEL_MIN_ELEMENTS){
+        bands = 1;
+    }
+    bands = std::min(bands, (long)rows);
+    ThreadPool::Shared().ParallelFor(0, (int)bands, 1, [&](int first, int last){
+        for (int t = first; t < last; t++){
+            RankRows(image, res, radius, rank, (int)(rows * t / bands), (int)(rows * (t + 1) / bands));
+        }
+    });
+    return res;
+}
+
+/**
+ *
+ * @param name a string
+ * @return true if ApplyFilter knows the filter.
+ */
+bool IsFilter(const std::string& name){
+    return name == "quant" || name == "blur" || name == "sobel" || name == "median";
+}
+
+/**
+ *
+ * @param name the name of a filter
+ * @param image a matrix
+ * @param parameter the parameter of the filter, -1 for its default
+ * @return a new matrix which is the result of the filter on the image.
+ */
+Matrix ApplyFilter(const std::string& name, const Matrix& image, int parameter){
+    if (name == "quant"){
+        return Quantization(image, (parameter != -1) ? parameter : 8);
+    }
+    if (name == "blur"){
+        return Blur(image);
+    }
+    if (name == "sobel"){
+        return Sobel(image);
+    }
+    if (name == "median"){
+        return Median(image, (parameter != -1) ? parameter : 1);
+    }
+    throw MatrixException(OPERATOR_ERROR);
+}
@@ -1,14 +1,60 @@
 #ifndef SOL_FILTERS_H
 #define SOL_FILTERS_H
 
+#include <string>
 #include "Matrix.h"
 
+/**
+ * The ways Quantization can choose the bounds of its levels.
+ * UNIFORM - levels of equal width.
+ * OTSU - recursive Otsu thresholding, every split maximizes the
+ * between-class variance.
+ * MEDIAN_CUT - every split divides the most populated level by its median.
+ * KMEANS - k-means on the histogram, seeded by median cut.
+ */
+enum class QuantizationMode { UNIFORM, OTSU, MEDIAN_CUT, KMEANS };
+
 
 Matrix Quantization(const Matrix& image,int levels);
 
+Matrix Quantization(const Matrix& image, int levels, QuantizationMode mode);
+
 Matrix Blur(const Matrix& image);
 
 Matrix Sobel(const Matrix& image);
 
+Matrix Median(const Matrix& image, int radius);
+
+Matrix RankFilter(const Matrix& image, int radius, float percentile);
+
+// The side of the tiles which the incremental filters compare and recompute
+#define INCREMENTAL_TILE 32
+
+/*
+ * Incremental filters for consecutive frames: prev_result holds the result
+ * of the filter on prev_image, and is patched in place into the result on
+ * image by recomputing only the tiles which changed (with their 1 pixel
+ * halo). The result is identical to running the filter on image.
+ * They return the amount of tiles which were recomputed.
+ */
+
+int BlurIncremental(const Matrix& prev_image, const Matrix& image,
+                    Matrix& prev_result, int tile = INCREMENTAL_TILE);
+
+int SobelIncremental(const Matrix& prev_image, const Matrix& image,
+                     Matrix& prev_result, int tile = INCREMENTAL_TILE);
+
+/*
+ * The filters by name, as the main program and the filter server select
+ * them: "quant" (parameter - levels, default 8), "blur", "sobel" and
+ * "median" (parameter - radius, default 1). A parameter of -1 selects the
+ * default, and a parameter out of the range of the filter (levels from 1
+ * to 256) throws.
+ */
+
+bool IsFilter(const std::string& name);
+
+Matrix ApplyFilter(const std::string& name, const Matrix& image, int parameter = -1);
+
 
 #endif //SOL_FILTERS_H
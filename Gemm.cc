@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <vector>
+#include "Gemm.h"
+#include "ThreadPool.h"
+
+// The micro kernel keeps a MR x NR block of C in registers
+#define GEMM_MR 4
+#define GEMM_NR 16
+
+// Blocks of A are MC x KC (in L2), panels of op(B) are KC x NC (in L3)
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 4096
+
+// Products with less multiply-adds than this run on the calling thread
+#define GEMM_PARALLEL_MIN 1000000L
+
+// -------- Static (helper) functions --------
+
+/**
+ * Packs alpha times the mc x kc block of A into micro panels of GEMM_MR
+ * rows, stored column after column; missing rows are zero.
+ */
+static void PackA(int mc, int kc, float alpha, const float *a, int lda, float *packed){
+    for (int i = 0; i < mc; i += GEMM_MR){
+        int rows = std::min(GEMM_MR, mc - i);
+        for (int p = 0; p < kc; p++){
+            for (int r = 0; r < GEMM_MR; r++){
+                *packed++ = (r < rows) ? alpha * a[(long)(i + r) * lda + p] : 0.0f;
+            }
+        }
+    }
+}
+
+/**
+ * Packs the kc x nc panel of op(B) into micro panels of GEMM_NR columns,
+ * stored row after row; missing columns are zero.
+ */
+static void PackB(int kc, int nc, const float *b, int ldb, bool transpose_b, float *packed){
+    for (int j = 0; j < nc; j += GEMM_NR){
+        int cols = std::min(GEMM_NR, nc - j);
+        for (int p = 0; p < kc; p++){
+            for (int c = 0; c < GEMM_NR; c++){
+                float value = 0.0f;
+                if (c < cols){
+                    value = transpose_b ? b[(long)(j + c) * ldb + p] : b[(long)p * ldb + j + c];
+                }
+                *packed++ = value;
+            }
+        }
+    }
+}
+
+/**
+ * C[rows x cols] += the product of a packed micro panel of A and a packed
+ * micro panel of op(B). The accumulator is a fixed size block, so the
+ * compiler keeps it in vector registers.
+ */
+static void MicroKernel(int kc, const float *a, const float *b, float *c, int ldc,
+                        int rows, int cols){
+    float acc[GEMM_MR][GEMM_NR] = {};
+    for (int p = 0; p < kc; p++){
+        for (int r = 0; r < GEMM_MR; r++){
+            float ar = a[r];
+            for (int x = 0; x < GEMM_NR; x++){
+                acc[r][x] += ar * b[x];
+            }
+        }
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+    for (int r = 0; r < rows; r++){
+        for (int x = 0; x < cols; x++){
+            c[(long)r * ldc + x] += acc[r][x];
+        }
+    }
+}
+
+// -------- End of static functions --------
+
+void Gemm(int m, int n, int k, float alpha, const float *a, int lda,
+          const float *b, int ldb, bool transpose_b, float beta,
+          float *c, int ldc) noexcept(false) {
+    if (m <= 0 || n <= 0){
+        return;
+    }
+    if (beta != 1.0f){
+        for (int i = 0; i < m; i++){
+            for (int j = 0; j < n; j++){
+                c[(long)i * ldc + j] = (beta == 0.0f) ? 0.0f : beta * c[(long)i * ldc + j];
+            }
+        }
+    }
+    if (k <= 0 || alpha == 0.0f){
+        return;
+    }
+
+    bool parallel = (long)m * n * k >= GEMM_PARALLEL_MIN;
+    int row_blocks = (m + GEMM_MC - 1) / GEMM_MC;
+    std::vector<float> packed_b((size_t)GEMM_KC * (std::min(n, GEMM_NC) + GEMM_NR));
+
+    for (int jc = 0; jc < n; jc += GEMM_NC){
+        int nc = std::min(GEMM_NC, n - jc);
+        for (int pc = 0; pc < k; pc += GEMM_KC){
+            int kc = std::min(GEMM_KC, k - pc);
+            const float *b_panel = transpose_b ? b + (long)jc * ldb + pc : b + (long)pc * ldb + jc;
+            PackB(kc, nc, b_panel, ldb, transpose_b, packed_b.data());
+
+            auto multiply = [&](int first, int last){
+                std::vector<float> packed_a((size_t)(GEMM_MC + GEMM_MR) * kc);
+                for (int block = first; block < last; block++){
+                    int ic = block * GEMM_MC;
+                    int mc = std::min(GEMM_MC, m - ic);
+                    PackA(mc, kc, alpha, a + (long)ic * lda + pc, lda, packed_a.data());
+                    for (int jr = 0; jr < nc; jr += GEMM_NR){
+                        for (int ir = 0; ir < mc; ir += GEMM_MR){
+                            MicroKernel(kc, &packed_a[(size_t)ir * kc], &packed_b[(size_t)jr * kc],
+                                        c + (long)(ic + ir) * ldc + jc + jr, ldc,
+                                        std::min(GEMM_MR, mc - ir), std::min(GEMM_NR, nc - jr));
+                        }
+                    }
+                }
+            };
+
+            if (parallel){
+                ThreadPool::Shared().ParallelFor(0, row_blocks, 1, multiply);
+            }
+            else{
+                multiply(0, row_blocks);
+            }
+        }
+    }
+}
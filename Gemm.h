@@ -0,0 +1,23 @@
+#ifndef SOL_GEMM_H
+#define SOL_GEMM_H
+
+/**
+ * General matrix multiplication on row major buffers:
+ * C = alpha * A * op(B) + beta * C, where A is m x k, op(B) is k x n and
+ * C is m x n. op(B) is B, or the transpose of B (then B is n x k).
+ *
+ * The product is blocked for the caches: panels of op(B) and blocks of A
+ * are packed into contiguous micro panels, and a register blocked micro
+ * kernel multiplies them. Large products split the row blocks of C over
+ * the shared pool, every element of C is computed by a single thread in a
+ * fixed order, so the result doesn't depend on the scheduling.
+ *
+ * @param lda the distance between rows of A
+ * @param ldb the distance between rows of B
+ * @param ldc the distance between rows of C
+ */
+void Gemm(int m, int n, int k, float alpha, const float *a, int lda,
+          const float *b, int ldb, bool transpose_b, float beta,
+          float *c, int ldc) noexcept(false);
+
+#endif //SOL_GEMM_H
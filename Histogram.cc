@@ -0,0 +1,119 @@
+#include "Histogram.h"
+#include "MatrixException.h"
+#include "ThreadPool.h"
+
+#define BINS_ERROR "Invalid histogram bins.\n"
+#define RANGE_ERROR "Invalid histogram range.\n"
+
+// Images smaller than this are counted by the calling thread alone
+#define MIN_PIXELS_PER_THREAD 65536
+
+// -------- Static (helper) functions --------
+
+/**
+ * Counts the values of the rows [first, last) of the image into counts.
+ * @param image a matrix
+ * @param first the first row (inclusive)
+ * @param last the last row (exclusive)
+ * @param hist the histogram which decides the bin of every value
+ * @param counts an array of hist.GetBins() zeroed counters
+ */
+static void CountRows(const Matrix& image, int first, int last,
+                      const Histogram& hist, long *counts){
+    int cols = image.GetCols();
+    for (int i = first; i < last; i++){
+        const float *row = image.Row(i);
+        for (int j = 0; j < cols; j++){
+            counts[hist.BinOf(row[j])]++;
+        }
+    }
+}
+
+// -------- End of static functions --------
+
+// -------- Private functions --------
+
+void Histogram::Count(const Matrix& image) noexcept(false) {
+    int rows = image.GetRows();
+    total_ = (long)rows * image.GetCols();
+
+    long bands = ThreadPool::Shared().GetThreads() + 1;
+    if (bands > total_ / MIN_PIXELS_PER_THREAD){
+        bands = total_ / MIN_PIXELS_PER_THREAD;
+    }
+    if (bands > rows){
+        bands = rows;
+    }
+
+    if (bands <= 1){
+        CountRows(image, 0, rows, *this, counts_.data());
+        return;
+    }
+
+    // Every band gets its own sub-histogram, so the threads never write
+    // to the same cache line while counting.
+    int bins = GetBins();
+    std::vector<std::vector<long>> partial(bands, std::vector<long>(bins, 0));
+    ThreadPool::Shared().ParallelFor(0, (int)bands, 1, [&](int first, int last){
+        for (int t = first; t < last; t++){
+            CountRows(image, (int)(rows * t / bands), (int)(rows * (t + 1) / bands),
+                      *this, partial[t].data());
+        }
+    });
+
+    // Merge the sub-histograms
+    for (long t = 0; t < bands; t++){
+        for (int b = 0; b < bins; b++){
+            counts_[b] += partial[t][b];
+        }
+    }
+}
+
+// -------- End of private functions --------
+
+Histogram::Histogram(const Matrix& image) noexcept(false)
+    : Histogram(image, NUM_SHADES, 0, NUM_SHADES) {}
+
+Histogram::Histogram(const Matrix& image, int bins, float low, float high) noexcept(false) {
+    if (bins <= 0){
+        throw MatrixException(BINS_ERROR);
+    }
+    if (!(low < high)){
+        throw MatrixException(RANGE_ERROR);
+    }
+
+    this->counts_.assign(bins, 0);
+    this->low_ = low;
+    this->high_ = high;
+    this->scale_ = (float)bins / (high - low);
+    this->total_ = 0;
+
+    Count(image);
+}
+
+int Histogram::GetBins() const noexcept {
+    return (int)this->counts_.size();
+}
+
+long Histogram::GetTotal() const noexcept {
+    return this->total_;
+}
+
+int Histogram::BinOf(float value) const noexcept {
+    float position = (value - low_) * scale_;
+    // Also catches NaN, which fails every comparison
+    if (!(position >= 0)){
+        return 0;
+    }
+    if (position >= (float)counts_.size()){
+        return (int)counts_.size() - 1;
+    }
+    return (int)position;
+}
+
+long Histogram::operator[](int bin) const noexcept(false) {
+    if ((bin < 0) || (bin >= GetBins())){
+        throw MatrixException(BINS_ERROR);
+    }
+    return this->counts_[bin];
+}
@@ -0,0 +1,70 @@
+#ifndef SOL_HISTOGRAM_H
+#define SOL_HISTOGRAM_H
+
+#include <vector>
+#include "Matrix.h"
+
+#define NUM_SHADES 256
+
+class Histogram {
+
+private:
+
+    std::vector<long> counts_;
+    float low_;
+    float high_;
+    float scale_;  // bins per unit of value
+    long total_;
+
+    /**
+     * Fills counts_ by scanning the image once. Large images are split
+     * into row bands on the shared pool, every band is counted into its
+     * own sub-histogram and the sub-histograms are merged at the end.
+     * @param image a matrix
+     */
+    void Count(const Matrix& image) noexcept(false);
+
+public:
+
+    /**
+     * Constructs the histogram of an 8-bit image: one bin per shade,
+     * values are floored and clamped to the range [0, 255].
+     * @param image a matrix
+     */
+    explicit Histogram(const Matrix& image) noexcept(false);
+
+    /**
+     * Constructs the histogram of a float image, with bins of equal
+     * width over the range [low, high]. Values outside the range are
+     * counted in the first or the last bin.
+     * @param image a matrix
+     * @param bins number of bins (positive)
+     * @param low lower bound of the range
+     * @param high upper bound of the range (greater than low)
+     */
+    Histogram(const Matrix& image, int bins, float low, float high) noexcept(false);
+
+    /**
+     * @return the amount of bins (int).
+     */
+    int GetBins() const noexcept;
+
+    /**
+     * @return the amount of values counted (the number of pixels).
+     */
+    long GetTotal() const noexcept;
+
+    /**
+     * @param value a float
+     * @return the index of the bin which the value is counted in.
+     */
+    int BinOf(float value) const noexcept;
+
+    /**
+     * @param bin an integer
+     * @return the amount of values in the given bin.
+     */
+    long operator[](int bin) const noexcept(false);
+};
+
+#endif //SOL_HISTOGRAM_H
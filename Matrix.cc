@@ -1,32 +1,117 @@
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include "Matrix.h"
 #include "MatrixException.h"
+#include "ThreadPool.h"
 
 #define DIMENSION_ERROR "Invalid matrix dimensions.\n"
 #define DIVISION_BY_ZERO_ERROR "Division by zero.\n"
 #define INDEX_RANGE_ERROR "Index out of range.\n"
 #define STREAM_ERROR "Error loading from input stream.\n"
 #define BAD_ALLOC "Allocation failed.\n"
+#define BUFFER_ERROR "Invalid buffer.\n"
 
 using namespace std;
 
 
 // -------- Static (helper) functions --------
 
-static float **AllocateMatrix(int rows, int cols) {
+/**
+ * Allocates the elements of a matrix in one contiguous block, initiated to 0.
+ * @return the owner of the elements.
+ */
+static std::shared_ptr<float> AllocateElements(int rows, int cols) {
     try{
-        // Allocate memory for the matrix
-        auto **mat = (float **)new float*[rows]; // Rows of the matrix
-        // Allocate memory for each pointer - rows of the matrix
-        for (int i = 0; i < rows; i++){
-            mat[i] = (float *)new float[cols];
-        }
-        return mat;
+        return std::shared_ptr<float>(new float[(size_t)rows * cols](), std::default_delete<float[]>());
 
     } catch (const std::bad_alloc& e) {
         throw MatrixException(BAD_ALLOC);
     }
+}
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t RotateLeft(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t HashRound(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = RotateLeft(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t HashMerge(uint64_t acc, uint64_t lane) {
+    acc ^= HashRound(0, lane);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/**
+ * Loads 2 floats as one 64 bit word. Adding 0 turns -0.0 into 0.0, so
+ * elements which compare equal always load the same bits.
+ */
+static uint64_t LoadPair(const float *p) {
+    float pair[2] = {p[0] + 0.0f, p[1] + 0.0f};
+    uint64_t word;
+    std::memcpy(&word, pair, sizeof(word));
+    return word;
+}
+
+/**
+ * xxHash64 of a row of floats. Stripes of 8 floats are consumed by 4
+ * independent lanes, which lets the compiler interleave (and vectorize)
+ * the multiplications of the lanes.
+ * @param row the elements
+ * @param n the amount of elements
+ * @param seed the hash of everything before the row
+ * @return the hash
+ */
+static uint64_t HashRow(const float *row, int n, uint64_t seed) {
+    uint64_t h;
+    int k = 0;
+    if (n >= 8){
+        uint64_t lanes[4] = {seed + PRIME64_1 + PRIME64_2, seed + PRIME64_2,
+                             seed, seed - PRIME64_1};
+        for (; k + 8 <= n; k += 8){
+            for (int l = 0; l < 4; l++){
+                lanes[l] = HashRound(lanes[l], LoadPair(row + k + 2 * l));
+            }
+        }
+        h = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7)
+            + RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+        for (int l = 0; l < 4; l++){
+            h = HashMerge(h, lanes[l]);
+        }
+    }
+    else{
+        h = seed + PRIME64_5;
+    }
+
+    h += (uint64_t)n * sizeof(float);
+    for (; k + 2 <= n; k += 2){
+        h ^= HashRound(0, LoadPair(row + k));
+        h = RotateLeft(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (k < n){
+        uint32_t word;
+        float last = row[k] + 0.0f;
+        std::memcpy(&word, &last, sizeof(word));
+        h ^= (uint64_t)word * PRIME64_1;
+        h = RotateLeft(h, 23) * PRIME64_2 + PRIME64_3;
+    }
 
+    // Avalanche
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
 }
 
 // -------- End of static functions --------
@@ -34,13 +119,51 @@ static float **AllocateMatrix(int rows, int cols) {
 // -------- Private functions --------
 
 void Matrix::FreeMatrix() noexcept {
-    if (this->mat_){
-        for (int i = 0; i < rows_; i++){
-            delete[] mat_[i];
-        }
-        delete[] mat_;
-        mat_ = nullptr;
+    delete[] mat_;
+    mat_ = nullptr;
+    owner_.reset();
+}
+
+void Matrix::Bind(float *data, int rows, int cols, int stride, std::shared_ptr<float> owner) noexcept(false) {
+    float **mat;
+    try{
+        mat = new float*[rows];
+    } catch (const std::bad_alloc& e) {
+        throw MatrixException(BAD_ALLOC);
     }
+    for (int i = 0; i < rows; i++){
+        mat[i] = data + (long)i * stride;
+    }
+
+    FreeMatrix();
+    ForgetHash();
+    this->mat_ = mat;
+    this->rows_ = rows;
+    this->cols_ = cols;
+    this->stride_ = stride;
+    this->owner_ = std::move(owner);
+}
+
+bool Matrix::OwnsElements() const noexcept {
+    // Elements from AllocateElements have the array deleter, wrapped memory
+    // has the deleter it was given
+    return owner_ && owner_.use_count() == 1 &&
+           std::get_deleter<std::default_delete<float[]>>(owner_) != nullptr;
+}
+
+uint64_t Matrix::CachedHash() const noexcept {
+    return OwnsElements() ? hash_.load(std::memory_order_relaxed) : 0;
+}
+
+void Matrix::Swap(Matrix &m) noexcept {
+    std::swap(mat_, m.mat_);
+    std::swap(rows_, m.rows_);
+    std::swap(cols_, m.cols_);
+    std::swap(stride_, m.stride_);
+    owner_.swap(m.owner_);
+    uint64_t h = hash_.load(std::memory_order_relaxed);
+    hash_.store(m.hash_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m.hash_.store(h, std::memory_order_relaxed);
 }
 
 // -------- End of private functions --------
@@ -52,34 +175,51 @@ Matrix::Matrix(int rows, int cols) noexcept(false) {
         throw MatrixException(DIMENSION_ERROR);
     }
 
-    this->rows_ = rows;
-    this->cols_ = cols;
+    // All elements are initialized to zero
+    std::shared_ptr<float> elements = AllocateElements(rows, cols);
+    Bind(elements.get(), rows, cols, cols, elements);
+}
 
-    this->mat_ = AllocateMatrix(this->rows_, this->cols_);
+Matrix::Matrix() noexcept(false) : Matrix::Matrix(1, 1) {}
 
-    // Initialize all elements to zero
-    for (int i = 0; i < rows; i++){
-        for (int j = 0; j < cols; j ++){
-            mat_[i][j] = 0;
-        }
+Matrix::Matrix (const Matrix &m) noexcept(false) : Matrix::Matrix(m.rows_, m.cols_) {
+    // Initialize all elements of this mat to be equal to elements of m
+    for (int i = 0; i < rows_; i++){
+        std::copy(m.mat_[i], m.mat_[i] + cols_, mat_[i]);
     }
+    this->hash_.store(m.CachedHash(), std::memory_order_relaxed);
 }
 
-Matrix::Matrix() noexcept(false) : Matrix::Matrix(1, 1) {}
-
-Matrix::Matrix (const Matrix &m) noexcept(false) {
-    this->rows_ = m.rows_;
-    this->cols_ = m.cols_;
+Matrix::Matrix(Matrix &&m) noexcept : rows_(0), cols_(0), stride_(0) {
+    Swap(m);
+}
 
-    // Allocate memory for the matrix
-    this->mat_ = AllocateMatrix(this->rows_, this->cols_);
+Matrix::Matrix(float *data, int rows, int cols, int stride) noexcept(false) {
+    if (rows <= 0 or cols <= 0 or stride < cols){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    if (data == nullptr){
+        throw MatrixException(BUFFER_ERROR);
+    }
+    Bind(data, rows, cols, stride, nullptr);
+}
 
-    // Initialize all elements of this mat to be equal to elements of m
-    for (int i = 0; i < rows_; i++){
-        for (int j = 0; j < cols_; j ++){
-            mat_[i][j] = m.mat_[i][j];
-        }
+Matrix::Matrix(float *data, int rows, int cols, int stride,
+               const std::function<void(float *)> &deleter) noexcept(false) {
+    if (rows <= 0 or cols <= 0 or stride < cols){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    if (data == nullptr or !deleter){
+        throw MatrixException(BUFFER_ERROR);
+    }
+    std::shared_ptr<float> owner;
+    try{
+        owner = std::shared_ptr<float>(data, deleter);
+    } catch (const std::bad_alloc& e) {
+        // The shared pointer already called the deleter
+        throw MatrixException(BAD_ALLOC);
     }
+    Bind(data, rows, cols, stride, owner);
 }
 
 int Matrix::GetRows() const noexcept{
@@ -90,34 +230,90 @@ int Matrix::GetCols() const noexcept{
     return this->cols_;
 }
 
+int Matrix::GetStride() const noexcept{
+    return this->stride_;
+}
+
+const float *Matrix::Data() const noexcept {
+    // A matrix which was moved from has no elements
+    return (rows_ > 0) ? this->mat_[0] : nullptr;
+}
+
+float *Matrix::Data() noexcept {
+    ForgetHash();
+    return (rows_ > 0) ? this->mat_[0] : nullptr;
+}
+
+std::shared_ptr<float> Matrix::SharedData() noexcept {
+    ForgetHash();
+    // Borrowed elements come out with an empty owner
+    return std::shared_ptr<float>(owner_, Data());
+}
+
+Matrix Matrix::View(int row, int col, int rows, int cols) noexcept(false) {
+    if (rows <= 0 or cols <= 0){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    if ((row < 0) || (col < 0) || (row + rows > this->rows_) || (col + cols > this->cols_)){
+        throw MatrixException(INDEX_RANGE_ERROR);
+    }
+    ForgetHash();
+    Matrix view;
+    view.Bind(mat_[row] + col, rows, cols, stride_, owner_);
+    return view;
+}
+
+void Matrix::ForgetHash() noexcept {
+    hash_.store(0, std::memory_order_relaxed);
+}
+
 Matrix Matrix::Vectorize() noexcept(false){
+    ForgetHash();
     if (this->cols_ == 1){
         // if the matrix is already a 1 column matrix
         return *this;
     }
     // construct a new matrix with 1 column and (rows_ + cols_) rows
     int new_rows = rows_ * cols_;
-    auto **new_mat = AllocateMatrix(new_rows, 1);
+    Matrix vec(new_rows, 1);
 
     int k = 0;
     for (int i = 0; i < rows_; i ++){
         for (int j = 0; j < cols_; j++){
-            new_mat[k][0] = this->mat_[i][j];
+            vec.mat_[k][0] = this->mat_[i][j];
             k ++;
         }
     }
 
-    // Free the current matrix
-    FreeMatrix();
-
-    // Modify the fields and return the matrix
-    this->mat_ = new_mat;
-    this->rows_ = new_rows;
-    this->cols_ = 1;
+    // Replace the current matrix and return it
+    Swap(vec);
 
     return *this;
 }
 
+uint64_t Matrix::Hash() const noexcept {
+    // Shared or borrowed elements may change behind the matrix, so their
+    // hash is computed on every call
+    bool owned = OwnsElements();
+    uint64_t h = owned ? hash_.load(std::memory_order_relaxed) : 0;
+    if (h != 0){
+        return h;
+    }
+
+    h = ((uint64_t)rows_ << 32) | (uint32_t)cols_;
+    for (int i = 0; i < rows_; i++){
+        h = HashRow(mat_[i], cols_, h);
+    }
+    // 0 marks a hash which wasn't computed
+    if (h == 0){
+        h = 1;
+    }
+    if (owned){
+        hash_.store(h, std::memory_order_relaxed);
+    }
+    return h;
+}
+
 void Matrix::Print() const noexcept{
     for (int i = 0; i < rows_; i++){
         for (int j = 0; j < cols_; j ++) {
@@ -133,28 +329,54 @@ Matrix &Matrix::operator=(const Matrix &m) noexcept(false) {
     if (&m == this){
         return *this;
     }
+    if (m.rows_ == 0){
+        // m was moved from
+        throw MatrixException(DIMENSION_ERROR);
+    }
 
-    // Frees matrix if necessary
-    FreeMatrix();
-
-    this->rows_ = m.GetRows();
-    this->cols_ = m.GetCols();
-
-    try{
-        float **new_mat = AllocateMatrix(this->rows_, this->cols_);
-        // The assignment
+    if ((this->rows_ != m.rows_) || (this->cols_ != m.cols_)){
+        // Allocate a new matrix, frees the current one
+        std::shared_ptr<float> elements = AllocateElements(m.rows_, m.cols_);
+        Bind(elements.get(), m.rows_, m.cols_, m.cols_, elements);
+    }
+
+    // The assignment. A view may overlap m: with the same stride, copying
+    // the rows away from the overlap reads every row of m before it is
+    // written, otherwise m is copied aside first
+    std::less<const float*> before;
+    const float *first = mat_[0];
+    const float *last = mat_[rows_ - 1] + cols_;
+    const float *m_first = m.mat_[0];
+    const float *m_last = m.mat_[rows_ - 1] + cols_;
+    bool overlap = before(first, m_last) && before(m_first, last);
+    if (overlap && stride_ != m.stride_){
+        Matrix copy(m);
+        return *this = copy;
+    }
+    if (overlap && before(m_first, first)){
+        for (int i = rows_ - 1; i >= 0; i--){
+            std::memmove(mat_[i], m.mat_[i], cols_ * sizeof(float));
+        }
+    }
+    else{
         for (int i = 0; i < rows_; i++){
-            for (int j = 0; j < cols_; j ++){
-                new_mat[i][j] = m.mat_[i][j];
-            }
+            std::memmove(mat_[i], m.mat_[i], cols_ * sizeof(float));
         }
-        this->mat_ = new_mat;
+    }
+    this->hash_.store(m.CachedHash(), std::memory_order_relaxed);
 
-        return *this;
+    return *this;
+}
 
-    } catch (const std::bad_alloc& e) {
-        throw MatrixException(BAD_ALLOC);
+Matrix &Matrix::operator=(Matrix &&m) noexcept(false) {
+    // Only elements which others see (a view, wrapped or exported memory)
+    // are written in place, otherwise taking the elements of m is enough
+    bool shared = (mat_ != nullptr) && (!owner_ || owner_.use_count() > 1);
+    if (shared && (this->rows_ == m.rows_) && (this->cols_ == m.cols_)){
+        return *this = m;
     }
+    Swap(m);
+    return *this;
 }
 
 float Matrix::operator()(int i, int j) const noexcept(false) {
@@ -168,9 +390,25 @@ float &Matrix::operator()(int i, int j) noexcept(false) {
     if ((i < 0) || (i >= this->rows_) || (j < 0) || (j >= this->cols_)){
         throw MatrixException(INDEX_RANGE_ERROR);
     }
+    ForgetHash();
     return this->mat_[i][j];
 }
 
+const float *Matrix::Row(int i) const noexcept(false) {
+    if ((i < 0) || (i >= this->rows_)){
+        throw MatrixException(INDEX_RANGE_ERROR);
+    }
+    return this->mat_[i];
+}
+
+float *Matrix::Row(int i) noexcept(false) {
+    if ((i < 0) || (i >= this->rows_)){
+        throw MatrixException(INDEX_RANGE_ERROR);
+    }
+    ForgetHash();
+    return this->mat_[i];
+}
+
 float Matrix::operator[](int k) const noexcept(false) {
     // length of each row in the matrix
     if (k < 0){
@@ -196,6 +434,7 @@ float &Matrix::operator[](int k) noexcept(false) {
         throw MatrixException(INDEX_RANGE_ERROR);
     }
     int j = k % r;
+    ForgetHash();
     return this->mat_[i][j];
 }
 
@@ -239,11 +478,13 @@ Matrix Matrix::operator*(const float s) const noexcept(false){
 
         Matrix mult(rows, cols);
 
-        for (int i = 0; i < rows; i++){
-            for (int j = 0; j < cols; j++){
-                mult.mat_[i][j] = s * this->mat_[i][j];
+        ParallelRows(rows, cols, [&](int first, int last){
+            for (int i = first; i < last; i++){
+                for (int j = 0; j < cols; j++){
+                    mult.mat_[i][j] = s * this->mat_[i][j];
+                }
             }
-        }
+        });
 
         return mult;
 
@@ -261,41 +502,19 @@ Matrix &Matrix::operator*=(const Matrix &m) noexcept(false){
         throw MatrixException(DIMENSION_ERROR);
     }
 
-    try {
-        float **new_mat = AllocateMatrix(this->rows_, m.GetCols());
-
-        for (int i = 0; i < this->rows_; i++){
-            for (int j = 0; j < m.GetCols(); j ++){
-                new_mat[i][j] = 0;
-            }
-        }
-
-        for (int i = 0; i < this->rows_; i ++){
-            for (int j = 0; j < m.GetCols(); j ++){
-                for (int k = 0; k < this->cols_; k ++){
-                    new_mat[i][j] += this->mat_[i][k] * m.mat_[k][j];
-                }
-            }
-        }
-
-        FreeMatrix();
-        this->mat_ = new_mat;
-        this->cols_ = m.GetCols();
-
-        return *this;
-
-    } catch (const std::bad_alloc& e) {
-        throw MatrixException(BAD_ALLOC);
-    }
+    return *this = *this * m;
 }
 
-Matrix &Matrix::operator*=(const float s) noexcept{
+Matrix &Matrix::operator*=(const float s) noexcept(false){
+    ForgetHash();
 
-    for (int i = 0; i < this->rows_; i ++){
-        for (int j = 0; j < this->cols_; j ++){
-            this->mat_[i][j] *= s;
+    ParallelRows(rows_, cols_, [&](int first, int last){
+        for (int i = first; i < last; i ++){
+            for (int j = 0; j < this->cols_; j ++){
+                this->mat_[i][j] *= s;
+            }
         }
-    }
+    });
 
     return *this;
 }
@@ -307,11 +526,13 @@ Matrix Matrix::operator/(float s) const noexcept(false) {
     try {
 
         Matrix div(this->rows_, this->cols_);
-        for (int i = 0; i < div.GetRows(); i ++){
-            for (int j = 0; j < div.GetCols(); j ++){
-                div(i, j) = mat_[i][j]/s;
+        ParallelRows(rows_, cols_, [&](int first, int last){
+            for (int i = first; i < last; i ++){
+                for (int j = 0; j < div.cols_; j ++){
+                    div.mat_[i][j] = mat_[i][j]/s;
+                }
             }
-        }
+        });
         return div;
 
     } catch (const std::bad_alloc& e) {
@@ -323,11 +544,14 @@ Matrix &Matrix::operator/=(float s) noexcept(false) {
     if (s == 0){
         throw MatrixException(DIVISION_BY_ZERO_ERROR);
     }
-    for (int i = 0; i < this->rows_; i ++){
-        for (int j = 0; j < this->cols_; j ++){
-            (*this)(i, j) = (*this)(i, j) / s;
+    ForgetHash();
+    ParallelRows(rows_, cols_, [&](int first, int last){
+        for (int i = first; i < last; i ++){
+            for (int j = 0; j < this->cols_; j ++){
+                this->mat_[i][j] = this->mat_[i][j] / s;
+            }
         }
-    }
+    });
     return *this;
 }
 
@@ -343,11 +567,13 @@ Matrix Matrix::operator+(const Matrix &m2) const noexcept(false) {
         Matrix add(this->rows_, this->cols_);
 
         // Add the 2 matrix and put the result in the new matrix - add
-        for (int i = 0; i < this->rows_; i ++){
-            for (int j = 0; j < this->cols_; j ++){
-                add(i, j) = this->mat_[i][j] + m2(i, j);
+        ParallelRows(rows_, cols_, [&](int first, int last){
+            for (int i = first; i < last; i ++){
+                for (int j = 0; j < this->cols_; j ++){
+                    add.mat_[i][j] = this->mat_[i][j] + m2.mat_[i][j];
+                }
             }
-        }
+        });
 
         return add;
 
@@ -362,23 +588,31 @@ Matrix &Matrix::operator+=(const Matrix &m) noexcept(false) {
         throw MatrixException(DIMENSION_ERROR);
     }
 
+    ForgetHash();
+
     // Add the given matrix m to the matrix of this
-    for (int i = 0; i < rows_; i ++){
-        for (int j = 0; j < cols_; j ++){
-            (*this)(i, j) += m(i, j);
+    ParallelRows(rows_, cols_, [&](int first, int last){
+        for (int i = first; i < last; i ++){
+            for (int j = 0; j < cols_; j ++){
+                this->mat_[i][j] += m.mat_[i][j];
+            }
         }
-    }
+    });
 
     return *this;
 }
 
-Matrix &Matrix::operator+=(const float s) noexcept {
+Matrix &Matrix::operator+=(const float s) noexcept(false) {
+    ForgetHash();
+
     // Add the scalar s to each element in this matrix.
-    for (int i = 0; i < rows_; i ++){
-        for (int j = 0; j < cols_; j ++){
-            (*this)(i, j) += s;
+    ParallelRows(rows_, cols_, [&](int first, int last){
+        for (int i = first; i < last; i ++){
+            for (int j = 0; j < cols_; j ++){
+                this->mat_[i][j] += s;
+            }
         }
-    }
+    });
     return *this;
 }
 
@@ -387,6 +621,13 @@ bool Matrix::operator==(const Matrix &m2) const noexcept {
         return false;
     }
 
+    // Different hashes mean different elements, if both are up to date
+    uint64_t h1 = this->CachedHash();
+    uint64_t h2 = m2.CachedHash();
+    if (h1 != 0 && h2 != 0 && h1 != h2){
+        return false;
+    }
+
     for (int i = 0; i < this->rows_; i ++){
         for (int j = 0; j < this->cols_; j++){
             if (this->mat_[i][j] != m2(i, j)){
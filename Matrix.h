@@ -1,4 +1,8 @@
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <memory>
 
 #ifndef EX5_MATRIX_H
 #define EX5_MATRIX_H
@@ -7,15 +11,47 @@ class Matrix {
 
 private:
 
-    float **mat_ = nullptr;
+    float **mat_ = nullptr;  // pointers to the rows, which lie stride_ floats apart
     int rows_;
     int cols_;
+    int stride_;
+
+    // Keeps the elements alive, empty when they are borrowed
+    std::shared_ptr<float> owner_;
+
+    // The content hash, 0 while it wasn't computed since the last change,
+    // kept only while OwnsElements()
+    mutable std::atomic<uint64_t> hash_{0};
 
     /**
      * The function deletes/frees the memory of the the 2-dimensional array - mat_
+     * (the elements are freed by their owner, when no matrix shares them).
      */
     void FreeMatrix() noexcept;
 
+    /**
+     * Points the matrix at rows * cols elements, stride floats apart.
+     * @param owner the owner of the elements, or empty if they are borrowed
+     */
+    void Bind(float *data, int rows, int cols, int stride, std::shared_ptr<float> owner) noexcept(false);
+
+    /**
+     * @return true if the matrix allocated its elements and nothing else
+     * (a view, an exported pointer) shares them, so they only change
+     * through the matrix.
+     */
+    bool OwnsElements() const noexcept;
+
+    /**
+     * @return the cached hash if it can be trusted, 0 otherwise.
+     */
+    uint64_t CachedHash() const noexcept;
+
+    /**
+     * Exchanges the elements and dimensions of two matrices.
+     */
+    void Swap(Matrix &m) noexcept;
+
 public:
 
     /**
@@ -32,11 +68,42 @@ public:
     Matrix() noexcept(false);
 
     /**
-     * Constructs matrix from another matrix.
+     * Constructs matrix from another matrix. The new matrix owns a copy of
+     * the elements, also when m is a view.
      * @param m type Matrix&
      */
     Matrix(const Matrix &m) noexcept(false);
 
+    /**
+     * Constructs matrix from a temporary matrix, taking its elements. The
+     * moved from matrix has no elements (0 x 0, Data() is null) until it's
+     * assigned to.
+     * @param m type Matrix&&
+     */
+    Matrix(Matrix &&m) noexcept;
+
+    /**
+     * Wraps external memory without copying it. The memory is borrowed: it
+     * must outlive the matrix (and its views), and it isn't freed.
+     * @param data the first element
+     * @param rows number of rows
+     * @param cols number of columns
+     * @param stride the distance between the starts of rows, at least cols
+     */
+    Matrix(float *data, int rows, int cols, int stride) noexcept(false);
+
+    /**
+     * Wraps external memory without copying it, and takes ownership of it:
+     * deleter(data) is called once the matrix and all its views are gone.
+     * @param data the first element
+     * @param rows number of rows
+     * @param cols number of columns
+     * @param stride the distance between the starts of rows, at least cols
+     * @param deleter frees the memory
+     */
+    Matrix(float *data, int rows, int cols, int stride,
+           const std::function<void(float *)> &deleter) noexcept(false);
+
     /**
      * @return the amount of rows (int).
      */
@@ -47,12 +114,72 @@ public:
      */
     int GetCols() const noexcept;
 
+    /**
+     * @return the distance between the starts of rows (in floats), which is
+     * the amount of columns unless the matrix is a view or wraps memory
+     * with padding.
+     */
+    int GetStride() const noexcept;
+
+    /**
+     * Element buffer access - const
+     * @return the first element, element (i, j) is at Data()[i * GetStride() + j],
+     * or null if the matrix was moved from.
+     */
+    const float* Data() const noexcept;
+
+    /**
+     * Element buffer access - non const
+     * @return the first element, element (i, j) is at Data()[i * GetStride() + j],
+     * or null if the matrix was moved from.
+     */
+    float* Data() noexcept;
+
+    /**
+     * Exports the elements without copying them.
+     * @return the first element, which shares the ownership of the elements
+     * with the matrix, so it stays valid after the matrix is gone (unless
+     * the matrix borrows them).
+     */
+    std::shared_ptr<float> SharedData() noexcept;
+
+    /**
+     * A view of a block of the matrix, which shares the elements: changes
+     * through the view change the matrix and vice versa.
+     * @param row the first row of the block
+     * @param col the first column of the block
+     * @param rows number of rows of the block
+     * @param cols number of columns of the block
+     * @return a new matrix on the elements of the block.
+     */
+    Matrix View(int row, int col, int rows, int cols) noexcept(false);
+
+    /**
+     * Forgets the cached content hash. Every non const function which may
+     * change the elements calls it, and it must be called after writing
+     * through a pointer or reference (Data(), Row(), operator()) which was
+     * taken before the hash was computed.
+     */
+    void ForgetHash() noexcept;
+
     /**
      * Transforms a matrix into a column vector.
      * @return the Matrix with the new mat_
      */
     Matrix Vectorize() noexcept(false);
 
+    /**
+     * Content hash (xxHash64 style) of the dimensions and the elements of the
+     * matrix. Equal matrices have equal hashes, 0.0 and -0.0 hash the same.
+     * The hash is cached until the matrix is changed through one of its non
+     * const functions, so references and row pointers which were taken
+     * before the hash was computed must not be written through afterwards
+     * (see ForgetHash). Views, wrapped memory and exported elements may
+     * change behind the matrix, so their hash is never cached.
+     * @return the hash (uint64_t), never 0.
+     */
+    uint64_t Hash() const noexcept;
+
     /**
      * Prints matrix elements, no return value (void).
      * Prints space after each element (not including the last element in the row).
@@ -61,12 +188,23 @@ public:
     void Print() const noexcept;
 
     /**
-     *
+     * Assignment. If the dimensions are equal the elements are copied into
+     * the elements of this matrix, so assigning to a view (or to wrapped
+     * memory) writes through it. rhs may be a view which overlaps this one.
      * @param rhs (Matrix &)
      * @return Matrix& after the assignment
      */
     Matrix& operator=(const Matrix &rhs) noexcept(false);
 
+    /**
+     * Assignment from a temporary matrix. A view, wrapped or exported memory
+     * of the same dimensions is written through like in the copy
+     * assignment, otherwise the elements of rhs are taken.
+     * @param rhs (Matrix &&)
+     * @return Matrix& after the assignment
+     */
+    Matrix& operator=(Matrix &&rhs) noexcept(false);
+
     /**
      * Parenthesis indexing - const
      * @param i an integer
@@ -83,6 +221,22 @@ public:
      */
     float& operator()(int i, int j) noexcept(false);
 
+    /**
+     * Row access - const
+     * @param i an integer
+     * @return a pointer to the first element of the i-th row, the elements
+     * of a row are contiguous in memory, and rows are GetStride() apart.
+     */
+    const float* Row(int i) const noexcept(false);
+
+    /**
+     * Row access - non const
+     * @param i an integer
+     * @return a pointer to the first element of the i-th row, the elements
+     * of a row are contiguous in memory, and rows are GetStride() apart.
+     */
+    float* Row(int i) noexcept(false);
+
     /**
      * Brackets indexing with one index - const
      * @param k
@@ -135,7 +289,7 @@ public:
      * @param s (float) a scalar
      * @return The result of multiplication of this matrix by the scalar s
      */
-    Matrix& operator*=(float s) noexcept;
+    Matrix& operator*=(float s) noexcept(false);
 
     /**
      * Scalar division on the right.
@@ -170,10 +324,12 @@ public:
      * @param s (float)
      * @return The addition of each element in this matrix by a scalar s.
      */
-    Matrix& operator+=(float s) noexcept;
+    Matrix& operator+=(float s) noexcept(false);
 
     /**
-     * Checks for Equality between 2 matrices
+     * Checks for Equality between 2 matrices. If the hashes of both matrices
+     * are cached (and up to date) and differ, returns without comparing the
+     * elements.
      * @param rhs (Matrix &)
      * @return true if the matrices are equal, false otherwise
      */
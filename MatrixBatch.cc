@@ -0,0 +1,202 @@
+#include <algorithm>
+#include "MatrixBatch.h"
+#include "MatrixException.h"
+#include "ThreadPool.h"
+
+#define DIMENSION_ERROR "Invalid matrix dimensions.\n"
+#define INDEX_RANGE_ERROR "Index out of range.\n"
+
+// -------- Static (helper) functions --------
+
+/**
+ * Calls body(block) on every block of BATCH_LANES elements of a batch, the
+ * blocks split over the shared pool.
+ * @param size the amount of elements, a multiple of BATCH_LANES
+ */
+template <class Body>
+static void ForEachBlock(size_t size, Body body){
+    ParallelRows((int)(size / BATCH_LANES), BATCH_LANES, [&](int first, int last){
+        for (int block = first; block < last; block++){
+            body((size_t)block * BATCH_LANES);
+        }
+    });
+}
+
+// -------- End of static functions --------
+
+MatrixBatch::MatrixBatch(int count, int rows, int cols) noexcept(false) {
+    if (count <= 0 || rows <= 0 || cols <= 0){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    this->count_ = count;
+    this->rows_ = rows;
+    this->cols_ = cols;
+    this->stride_ = (count + BATCH_LANES - 1) / BATCH_LANES * BATCH_LANES;
+    this->data_.assign((size_t)stride_ * rows * cols, 0.0f);
+}
+
+MatrixBatch::MatrixBatch(const std::vector<Matrix> &matrices) noexcept(false) :
+        MatrixBatch((int)matrices.size(), matrices.empty() ? 0 : matrices[0].GetRows(),
+                    matrices.empty() ? 0 : matrices[0].GetCols()) {
+    for (int b = 0; b < count_; b++){
+        Set(b, matrices[b]);
+    }
+}
+
+int MatrixBatch::GetCount() const noexcept {
+    return this->count_;
+}
+
+int MatrixBatch::GetRows() const noexcept {
+    return this->rows_;
+}
+
+int MatrixBatch::GetCols() const noexcept {
+    return this->cols_;
+}
+
+const float *MatrixBatch::Lane(int i, int j) const noexcept(false) {
+    if ((i < 0) || (i >= rows_) || (j < 0) || (j >= cols_)){
+        throw MatrixException(INDEX_RANGE_ERROR);
+    }
+    return &data_[((size_t)i * cols_ + j) * stride_];
+}
+
+float *MatrixBatch::Lane(int i, int j) noexcept(false) {
+    if ((i < 0) || (i >= rows_) || (j < 0) || (j >= cols_)){
+        throw MatrixException(INDEX_RANGE_ERROR);
+    }
+    return &data_[((size_t)i * cols_ + j) * stride_];
+}
+
+float MatrixBatch::operator()(int b, int i, int j) const noexcept(false) {
+    if ((b < 0) || (b >= count_)){
+        throw MatrixException(INDEX_RANGE_ERROR);
+    }
+    return Lane(i, j)[b];
+}
+
+float &MatrixBatch::operator()(int b, int i, int j) noexcept(false) {
+    if ((b < 0) || (b >= count_)){
+        throw MatrixException(INDEX_RANGE_ERROR);
+    }
+    return Lane(i, j)[b];
+}
+
+Matrix MatrixBatch::Get(int b) const noexcept(false) {
+    if ((b < 0) || (b >= count_)){
+        throw MatrixException(INDEX_RANGE_ERROR);
+    }
+    Matrix m(rows_, cols_);
+    for (int i = 0; i < rows_; i++){
+        float *row = m.Row(i);
+        for (int j = 0; j < cols_; j++){
+            row[j] = data_[((size_t)i * cols_ + j) * stride_ + b];
+        }
+    }
+    return m;
+}
+
+void MatrixBatch::Set(int b, const Matrix &m) noexcept(false) {
+    if ((b < 0) || (b >= count_)){
+        throw MatrixException(INDEX_RANGE_ERROR);
+    }
+    if (m.GetRows() != rows_ || m.GetCols() != cols_){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    for (int i = 0; i < rows_; i++){
+        const float *row = m.Row(i);
+        for (int j = 0; j < cols_; j++){
+            data_[((size_t)i * cols_ + j) * stride_ + b] = row[j];
+        }
+    }
+}
+
+MatrixBatch MatrixBatch::operator*(const MatrixBatch &rhs) const noexcept(false) {
+    if (count_ != rhs.count_ || cols_ != rhs.rows_){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    int k = cols_;
+    int n = rhs.cols_;
+    int rows = rows_;
+    long stride = stride_;
+    MatrixBatch res(count_, rows, n);
+    const float *a = data_.data();
+    const float *b = rhs.data_.data();
+    float *c = res.data_.data();
+
+    // Every block of matrices is multiplied with the usual triple loop,
+    // whose innermost step is a multiply-add along a block of lanes into a
+    // local accumulator (which can't alias the operands)
+    auto multiply = [=](int first, int last){
+        float acc[BATCH_LANES];
+        for (int block = first; block < last; block++){
+            long b0 = (long)block * BATCH_LANES;
+            for (int i = 0; i < rows; i++){
+                for (int j = 0; j < n; j++){
+                    std::fill(acc, acc + BATCH_LANES, 0.0f);
+                    for (int p = 0; p < k; p++){
+                        const float *x = a + ((long)i * k + p) * stride + b0;
+                        const float *y = b + ((long)p * n + j) * stride + b0;
+                        for (int t = 0; t < BATCH_LANES; t++){
+                            acc[t] += x[t] * y[t];
+                        }
+                    }
+                    std::copy(acc, acc + BATCH_LANES, c + ((long)i * n + j) * stride + b0);
+                }
+            }
+        }
+    };
+
+    int blocks = stride_ / BATCH_LANES;
+    if ((long)stride * rows * n * k < PARALLEL_MIN_ELEMENTS){
+        multiply(0, blocks);
+    }
+    else{
+        ThreadPool::Shared().ParallelFor(0, blocks, 1, multiply);
+    }
+    return res;
+}
+
+MatrixBatch MatrixBatch::operator*(float s) const noexcept(false) {
+    MatrixBatch res(*this);
+    res *= s;
+    return res;
+}
+
+MatrixBatch &MatrixBatch::operator*=(float s) noexcept(false) {
+    float *data = data_.data();
+    ForEachBlock(data_.size(), [data, s](size_t begin){
+        float *x = data + begin;
+        for (int t = 0; t < BATCH_LANES; t++){
+            x[t] *= s;
+        }
+    });
+    return *this;
+}
+
+MatrixBatch MatrixBatch::operator+(const MatrixBatch &rhs) const noexcept(false) {
+    MatrixBatch res(*this);
+    res += rhs;
+    return res;
+}
+
+MatrixBatch &MatrixBatch::operator+=(const MatrixBatch &rhs) noexcept(false) {
+    if (count_ != rhs.count_ || rows_ != rhs.rows_ || cols_ != rhs.cols_){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    float *data = data_.data();
+    const float *other = rhs.data_.data();
+    ForEachBlock(data_.size(), [data, other](size_t begin){
+        // The sum goes through a local array, so the compiler knows the
+        // operands don't overlap
+        float sum[BATCH_LANES];
+        float *x = data + begin;
+        const float *y = other + begin;
+        for (int t = 0; t < BATCH_LANES; t++){
+            sum[t] = x[t] + y[t];
+        }
+        std::copy(sum, sum + BATCH_LANES, x);
+    });
+    return *this;
+}
@@ -0,0 +1,128 @@
+#ifndef SOL_MATRIX_BATCH_H
+#define SOL_MATRIX_BATCH_H
+
+#include <vector>
+#include "Matrix.h"
+
+// The batched operations work on blocks of this many matrices at a time,
+// so the lanes they touch stay in the cache. Lanes are padded to a multiple
+// of it, so every inner loop has the same fixed length
+#define BATCH_LANES 64
+
+/**
+ * A batch of count matrices of the same size, stored as a structure of
+ * arrays: element (i, j) of all the matrices is one contiguous lane, and
+ * element (i, j) of matrix b is at Lane(i, j)[b]. The operations run
+ * element by element along the lanes, so every loop spans many matrices
+ * and the compiler vectorizes it, whatever the (small) size of the
+ * matrices is.
+ */
+class MatrixBatch {
+
+private:
+
+    int count_;
+    int rows_;
+    int cols_;
+    int stride_;  // the distance between lanes, count_ rounded up to BATCH_LANES
+    std::vector<float> data_;  // padding elements are always 0
+
+public:
+
+    /**
+     * Constructs count matrices rows * cols, all elements are 0.
+     * @param count number of matrices
+     * @param rows number of rows of every matrix
+     * @param cols number of columns of every matrix
+     */
+    MatrixBatch(int count, int rows, int cols) noexcept(false);
+
+    /**
+     * Constructs a batch of copies of the matrices.
+     * @param matrices non empty, all of the same size
+     */
+    explicit MatrixBatch(const std::vector<Matrix> &matrices) noexcept(false);
+
+    /**
+     * @return the amount of matrices.
+     */
+    int GetCount() const noexcept;
+
+    /**
+     * @return the amount of rows of every matrix.
+     */
+    int GetRows() const noexcept;
+
+    /**
+     * @return the amount of columns of every matrix.
+     */
+    int GetCols() const noexcept;
+
+    /**
+     * Lane access - const
+     * @return element (i, j) of all the matrices, count contiguous floats.
+     */
+    const float* Lane(int i, int j) const noexcept(false);
+
+    /**
+     * Lane access - non const
+     * @return element (i, j) of all the matrices, count contiguous floats.
+     */
+    float* Lane(int i, int j) noexcept(false);
+
+    /**
+     * Element access - const
+     * @return element (i, j) of matrix b.
+     */
+    float operator()(int b, int i, int j) const noexcept(false);
+
+    /**
+     * Element access - non const
+     * @return element (i, j) of matrix b.
+     */
+    float& operator()(int b, int i, int j) noexcept(false);
+
+    /**
+     * @param b index of a matrix
+     * @return a copy of matrix b.
+     */
+    Matrix Get(int b) const noexcept(false);
+
+    /**
+     * Copies a matrix of the size of the batch into matrix b.
+     */
+    void Set(int b, const Matrix &m) noexcept(false);
+
+    /**
+     * Matrix multiplication of every pair of matrices.
+     * @param rhs a batch of the same count, rows of its matrices equal to
+     * the columns of these
+     * @return a new batch, matrix b is this[b] * rhs[b].
+     */
+    MatrixBatch operator*(const MatrixBatch &rhs) const noexcept(false);
+
+    /**
+     * Scalar multiplication of every matrix.
+     * @return a new batch.
+     */
+    MatrixBatch operator*(float s) const noexcept(false);
+
+    /**
+     * Scalar multiplication of every matrix in place.
+     */
+    MatrixBatch& operator*=(float s) noexcept(false);
+
+    /**
+     * Addition of every pair of matrices.
+     * @param rhs a batch of the same count and size
+     * @return a new batch.
+     */
+    MatrixBatch operator+(const MatrixBatch &rhs) const noexcept(false);
+
+    /**
+     * Addition of every pair of matrices in place.
+     */
+    MatrixBatch& operator+=(const MatrixBatch &rhs) noexcept(false);
+};
+
+#endif //SOL_MATRIX_BATCH_H
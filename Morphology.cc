@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "Morphology.h"
+#include "MatrixException.h"
+#include "ThreadPool.h"
+
+#define ELEMENT_ERROR "Invalid structuring element.\n"
+
+// The column pass works on strips of this many columns, and keeps three
+// blocks of the window length of them (1.5KB per row of the window), so
+// its buffers stay in cache whatever the height of the image
+#define STRIP_COLS 128
+
+/**
+ * The operation of erosion: the minimum, ignoring pixels outside of the
+ * image means padding them with +infinity.
+ */
+struct MinOp {
+    static float Apply(float a, float b){ return b < a ? b : a; }
+    static float Identity(){ return std::numeric_limits<float>::infinity(); }
+};
+
+/**
+ * The operation of dilation: the maximum, padded with -infinity.
+ */
+struct MaxOp {
+    static float Apply(float a, float b){ return b > a ? b : a; }
+    static float Identity(){ return -std::numeric_limits<float>::infinity(); }
+};
+
+// -------- Static (helper) functions --------
+
+/**
+ * The 1D van Herk / Gil-Werman filter of every row: the padded row is cut
+ * into blocks of length k, and within every block g holds the prefix and
+ * h the suffix of the operation. The window at j spans the end of one
+ * block and the start of the next, so its result is Op(h[j], g[j + k - 1]).
+ * @param k the length of the window
+ */
+template <class Op>
+static void RowPass(const Matrix& in, Matrix& out, int k){
+    int cols = in.GetCols();
+    int anchor = k / 2;
+    int length = (cols + k - 1 + k - 1) / k * k;
+
+    ParallelRows(in.GetRows(), cols, [&](int first, int last){
+        std::vector<float> e(length);
+        std::vector<float> g(length);
+        std::vector<float> h(length);
+        for (int i = first; i < last; i++){
+            const float *row = in.Row(i);
+            for (int t = 0; t < length; t++){
+                int src = t - anchor;
+                e[t] = (src >= 0 && src < cols) ? row[src] : Op::Identity();
+            }
+            for (int b = 0; b < length; b += k){
+                g[b] = e[b];
+                for (int t = b + 1; t < b + k; t++){
+                    g[t] = Op::Apply(g[t - 1], e[t]);
+                }
+                h[b + k - 1] = e[b + k - 1];
+                for (int t = b + k - 2; t >= b; t--){
+                    h[t] = Op::Apply(h[t + 1], e[t]);
+                }
+            }
+            float *dst = out.Row(i);
+            for (int j = 0; j < cols; j++){
+                dst[j] = Op::Apply(h[j], g[j + k - 1]);
+            }
+        }
+    });
+}
+
+/**
+ * The same filter along the columns. Every step combines whole rows of a
+ * strip element by element, so the loops run across the columns and the
+ * compiler vectorizes them. The rows of block b of the result only need
+ * the suffixes of block b and the prefixes of blocks b and b + 1, so a
+ * strip keeps three blocks of prefixes and suffixes at a time.
+ * @param k the length of the window
+ */
+template <class Op>
+static void ColumnPass(const Matrix& in, Matrix& out, int k){
+    int rows = in.GetRows();
+    int cols = in.GetCols();
+    int anchor = k / 2;
+    int strips = (cols + STRIP_COLS - 1) / STRIP_COLS;
+
+    auto filter = [&](int first, int last){
+        std::vector<float> identity(STRIP_COLS, Op::Identity());
+        std::vector<float> g((size_t)k * STRIP_COLS);
+        std::vector<float> g_next((size_t)k * STRIP_COLS);
+        std::vector<float> h((size_t)k * STRIP_COLS);
+        for (int s = first; s < last; s++){
+            int c0 = s * STRIP_COLS;
+            int w = std::min(STRIP_COLS, cols - c0);
+
+            // The row of the strip at padded position t
+            auto e = [&](int t){
+                int src = t - anchor;
+                return (src >= 0 && src < rows) ? in.Row(src) + c0 : identity.data();
+            };
+            auto prefixes = [&](int b, std::vector<float>& out_g){
+                std::copy(e(b * k), e(b * k) + w, out_g.data());
+                for (int t = 1; t < k; t++){
+                    const float *prev = &out_g[(size_t)(t - 1) * STRIP_COLS];
+                    const float *src = e(b * k + t);
+                    float *cur = &out_g[(size_t)t * STRIP_COLS];
+                    for (int x = 0; x < w; x++){
+                        cur[x] = Op::Apply(prev[x], src[x]);
+                    }
+                }
+            };
+
+            prefixes(0, g);
+            for (int b = 0; b * k < rows; b++){
+                prefixes(b + 1, g_next);
+                std::copy(e(b * k + k - 1), e(b * k + k - 1) + w, &h[(size_t)(k - 1) * STRIP_COLS]);
+                for (int t = k - 2; t >= 0; t--){
+                    const float *next = &h[(size_t)(t + 1) * STRIP_COLS];
+                    const float *src = e(b * k + t);
+                    float *cur = &h[(size_t)t * STRIP_COLS];
+                    for (int x = 0; x < w; x++){
+                        cur[x] = Op::Apply(next[x], src[x]);
+                    }
+                }
+
+                // Row i = b * k + t needs the prefix at i + k - 1, the last
+                // of block b for t = 0 and in block b + 1 otherwise
+                for (int t = 0; t < k && b * k + t < rows; t++){
+                    const float *suffix = &h[(size_t)t * STRIP_COLS];
+                    const float *prefix = (t == 0) ? &g[(size_t)(k - 1) * STRIP_COLS]
+                                                   : &g_next[(size_t)(t - 1) * STRIP_COLS];
+                    float *dst = out.Row(b * k + t) + c0;
+                    for (int x = 0; x < w; x++){
+                        dst[x] = Op::Apply(suffix[x], prefix[x]);
+                    }
+                }
+                g.swap(g_next);
+            }
+        }
+    };
+
+    if ((long)rows * cols < PARALLEL_MIN_ELEMENTS){
+        filter(0, strips);
+    }
+    else{
+        ThreadPool::Shared().ParallelFor(0, strips, 1, filter);
+    }
+}
+
+/**
+ * Applies the 1D filter along the rows and then along the columns.
+ */
+template <class Op>
+static Matrix Separable(const Matrix& image, int width, int height){
+    if (width <= 0 || height <= 0){
+        throw MatrixException(ELEMENT_ERROR);
+    }
+    Matrix rows_done(image.GetRows(), image.GetCols());
+    RowPass<Op>(image, rows_done, width);
+    Matrix res(image.GetRows(), image.GetCols());
+    ColumnPass<Op>(rows_done, res, height);
+    return res;
+}
+
+/**
+ * Sets res to a - b element by element, res may be a or b.
+ */
+static void Subtract(const Matrix& a, const Matrix& b, Matrix& res){
+    ParallelRows(a.GetRows(), a.GetCols(), [&](int first, int last){
+        for (int i = first; i < last; i++){
+            const float *x = a.Row(i);
+            const float *y = b.Row(i);
+            float *dst = res.Row(i);
+            for (int j = 0; j < a.GetCols(); j++){
+                dst[j] = x[j] - y[j];
+            }
+        }
+    });
+}
+
+// -------- End of static functions --------
+
+/**
+ *
+ * @param image a matrix
+ * @param width the columns of the structuring element
+ * @param height the rows of the structuring element
+ * @return a new matrix where every pixel is the minimum of its window.
+ */
+Matrix Erode(const Matrix& image, int width, int height){
+    return Separable<MinOp>(image, width, height);
+}
+
+/**
+ *
+ * @param image a matrix
+ * @param width the columns of the structuring element
+ * @param height the rows of the structuring element
+ * @return a new matrix where every pixel is the maximum of its window.
+ */
+Matrix Dilate(const Matrix& image, int width, int height){
+    return Separable<MaxOp>(image, width, height);
+}
+
+/**
+ *
+ * @param image a matrix
+ * @param width the columns of the structuring element
+ * @param height the rows of the structuring element
+ * @return a new matrix which is the dilation of the erosion of the image,
+ * which removes bright details smaller than the element.
+ */
+Matrix Open(const Matrix& image, int width, int height){
+    return Dilate(Erode(image, width, height), width, height);
+}
+
+/**
+ *
+ * @param image a matrix
+ * @param width the columns of the structuring element
+ * @param height the rows of the structuring element
+ * @return a new matrix which is the erosion of the dilation of the image,
+ * which removes dark details smaller than the element.
+ */
+Matrix Close(const Matrix& image, int width, int height){
+    return Erode(Dilate(image, width, height), width, height);
+}
+
+/**
+ *
+ * @param image a matrix
+ * @param width the columns of the structuring element
+ * @param height the rows of the structuring element
+ * @return a new matrix which is the image minus its opening: the bright
+ * details smaller than the element.
+ */
+Matrix TopHat(const Matrix& image, int width, int height){
+    Matrix res = Open(image, width, height);
+    Subtract(image, res, res);
+    return res;
+}
+
+/**
+ *
+ * @param image a matrix
+ * @param width the columns of the structuring element
+ * @param height the rows of the structuring element
+ * @return a new matrix which is the closing of the image minus the image:
+ * the dark details smaller than the element.
+ */
+Matrix BlackHat(const Matrix& image, int width, int height){
+    Matrix res = Close(image, width, height);
+    Subtract(res, image, res);
+    return res;
+}
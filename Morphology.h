@@ -0,0 +1,27 @@
+#ifndef SOL_MORPHOLOGY_H
+#define SOL_MORPHOLOGY_H
+
+#include "Matrix.h"
+
+/*
+ * Gray-scale morphology with a width x height rectangular structuring
+ * element, anchored at (height / 2, width / 2). The element is separable,
+ * so every operator is a row pass and a column pass of 1D minimum or
+ * maximum filters, computed with the van Herk / Gil-Werman algorithm in
+ * about 3 comparisons per pixel whatever the size of the element.
+ * Pixels outside of the image are ignored.
+ */
+
+Matrix Erode(const Matrix& image, int width, int height);
+
+Matrix Dilate(const Matrix& image, int width, int height);
+
+Matrix Open(const Matrix& image, int width, int height);
+
+Matrix Close(const Matrix& image, int width, int height);
+
+Matrix TopHat(const Matrix& image, int width, int height);
+
+Matrix BlackHat(const Matrix& image, int width, int height);
+
+#endif //SOL_MORPHOLOGY_H
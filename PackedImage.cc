@@ -0,0 +1,406 @@
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include "PackedImage.h"
+#include "MatrixException.h"
+#include "ThreadPool.h"
+
+#define PALETTE_ERROR "Too many distinct values to pack.\n"
+#define FORMAT_ERROR "Invalid packed image.\n"
+#define STREAM_ERROR "Error loading from input stream.\n"
+#define SIZE_ERROR "Too many pixels to pack.\n"
+
+#define PACKED_MAGIC "MQPK"
+#define PACKED_VERSION 1
+
+// Indices are packed in groups of 8, which take exactly bits bytes
+#define GROUP_PIXELS 8
+
+// The data of a packed file is read in chunks of this many bytes
+#define READ_CHUNK (1 << 20)
+
+// -------- Static (helper) functions --------
+
+/**
+ * @return the bits of a float, with -0.0 turned into 0.0.
+ */
+static uint32_t KeyOf(float value){
+    uint32_t key;
+    value += 0.0f;
+    std::memcpy(&key, &value, sizeof(key));
+    return key;
+}
+
+/**
+ * Finds the distinct values of an image and the index of every pixel.
+ * @param palette the values, in the order of their first pixel
+ * @param indices the index of every pixel row after row, padded with 0 to
+ * a whole group
+ */
+static void BuildPalette(const Matrix &image, std::vector<float> &palette, std::vector<uint8_t> &indices){
+    int rows = image.GetRows();
+    int cols = image.GetCols();
+    std::unordered_map<uint32_t, int> index_of;
+    indices.assign(((size_t)rows * cols + GROUP_PIXELS - 1) / GROUP_PIXELS * GROUP_PIXELS, 0);
+
+    // Neighbouring pixels are mostly equal, so the last value is remembered
+    uint32_t last_key = KeyOf(image.Row(0)[0]);
+    int last_index = -1;
+    size_t k = 0;
+    for (int i = 0; i < rows; i++){
+        const float *row = image.Row(i);
+        for (int j = 0; j < cols; j++){
+            uint32_t key = KeyOf(row[j]);
+            if (key != last_key || last_index < 0){
+                auto it = index_of.find(key);
+                if (it == index_of.end()){
+                    if ((int)palette.size() == MAX_PALETTE){
+                        throw MatrixException(PALETTE_ERROR);
+                    }
+                    it = index_of.emplace(key, (int)palette.size()).first;
+                    palette.push_back(row[j] + 0.0f);
+                }
+                last_key = key;
+                last_index = it->second;
+            }
+            indices[k++] = (uint8_t)last_index;
+        }
+    }
+}
+
+/**
+ * @return the bits needed for an index of a palette of the given size.
+ */
+static int BitsFor(int levels){
+    int bits = 1;
+    while ((1 << bits) < levels){
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ * Packs the indices, a whole amount of groups, bits each: the 8 indices of
+ * a group are shifted into one 64 bit word, whose low bytes are stored.
+ * The inner loops have fixed lengths and no branches, so the compiler
+ * unrolls them.
+ */
+static std::vector<uint8_t> PackBits(const std::vector<uint8_t> &indices, int bits){
+    size_t groups = indices.size() / GROUP_PIXELS;
+    std::vector<uint8_t> data(groups * bits);
+    for (size_t g = 0; g < groups; g++){
+        const uint8_t *group = &indices[g * GROUP_PIXELS];
+        uint64_t word = 0;
+        for (int t = 0; t < GROUP_PIXELS; t++){
+            word |= (uint64_t)group[t] << (t * bits);
+        }
+        for (int b = 0; b < bits; b++){
+            data[g * bits + b] = (uint8_t)(word >> (8 * b));
+        }
+    }
+    return data;
+}
+
+/**
+ * The inverse of PackBits.
+ * @param indices a whole amount of groups, overwritten
+ */
+static void UnpackBits(const std::vector<uint8_t> &data, int bits, std::vector<uint8_t> &indices){
+    size_t groups = indices.size() / GROUP_PIXELS;
+    if (data.size() != groups * bits){
+        throw MatrixException(FORMAT_ERROR);
+    }
+    uint64_t mask = (1u << bits) - 1;
+    for (size_t g = 0; g < groups; g++){
+        uint64_t word = 0;
+        for (int b = 0; b < bits; b++){
+            word |= (uint64_t)data[g * bits + b] << (8 * b);
+        }
+        uint8_t *group = &indices[g * GROUP_PIXELS];
+        for (int t = 0; t < GROUP_PIXELS; t++){
+            group[t] = (uint8_t)((word >> (t * bits)) & mask);
+        }
+    }
+}
+
+/**
+ * Replaces every index below the first row by its difference from the
+ * index above, modulo the size of the palette. Rows which repeat the row
+ * above turn into runs of zeros.
+ */
+static void ToRowDeltas(std::vector<uint8_t> &indices, int rows, int cols, int levels){
+    for (int i = rows - 1; i > 0; i--){
+        uint8_t *row = &indices[(size_t)i * cols];
+        const uint8_t *above = row - cols;
+        for (int j = 0; j < cols; j++){
+            row[j] = (uint8_t)((row[j] + levels - above[j]) % levels);
+        }
+    }
+}
+
+/**
+ * The inverse of ToRowDeltas.
+ */
+static void FromRowDeltas(std::vector<uint8_t> &indices, int rows, int cols, int levels){
+    for (int i = 1; i < rows; i++){
+        uint8_t *row = &indices[(size_t)i * cols];
+        const uint8_t *above = row - cols;
+        for (int j = 0; j < cols; j++){
+            row[j] = (uint8_t)((row[j] + above[j]) % levels);
+        }
+    }
+}
+
+/**
+ * Run length encoding of the first count indices: every run is its index
+ * (a byte), then its length minus one in 7 bit groups, low group first, the
+ * high bit of a byte set if another group follows.
+ */
+static std::vector<uint8_t> EncodeRuns(const std::vector<uint8_t> &indices, size_t count){
+    std::vector<uint8_t> data;
+    size_t k = 0;
+    while (k < count){
+        size_t end = k + 1;
+        while (end < count && indices[end] == indices[k]){
+            end++;
+        }
+        data.push_back(indices[k]);
+        size_t length = end - k - 1;
+        while (length >= 0x80){
+            data.push_back((uint8_t)(length | 0x80));
+            length >>= 7;
+        }
+        data.push_back((uint8_t)length);
+        k = end;
+    }
+    return data;
+}
+
+/**
+ * The inverse of EncodeRuns.
+ * @param count the amount of indices the runs must cover
+ */
+static void DecodeRuns(const std::vector<uint8_t> &data, size_t count, std::vector<uint8_t> &indices){
+    size_t k = 0;
+    size_t pos = 0;
+    while (pos < data.size()){
+        uint8_t index = data[pos++];
+        size_t length = 0;
+        int shift = 0;
+        while (true){
+            if (pos == data.size() || shift > 56){
+                throw MatrixException(FORMAT_ERROR);
+            }
+            uint8_t byte = data[pos++];
+            length |= (size_t)(byte & 0x7f) << shift;
+            shift += 7;
+            if (!(byte & 0x80)){
+                break;
+            }
+        }
+        if (length >= count - k){
+            throw MatrixException(FORMAT_ERROR);
+        }
+        std::memset(&indices[k], index, length + 1);
+        k += length + 1;
+    }
+    if (k != count){
+        throw MatrixException(FORMAT_ERROR);
+    }
+}
+
+static void PutU32(std::ostream &output, uint32_t value){
+    char bytes[4];
+    for (int b = 0; b < 4; b++){
+        bytes[b] = (char)(value >> (8 * b));
+    }
+    output.write(bytes, 4);
+}
+
+static uint32_t GetU32(std::istream &input){
+    unsigned char bytes[4] = {};
+    input.read((char *)bytes, 4);
+    uint32_t value = 0;
+    for (int b = 0; b < 4; b++){
+        value |= (uint32_t)bytes[b] << (8 * b);
+    }
+    return value;
+}
+
+// -------- End of static functions --------
+
+PackedImage::PackedImage() noexcept : rows_(0), cols_(0), bits_(1), mode_(PackingMode::BITS) {}
+
+PackedImage PackedImage::Pack(const Matrix &image, PackingMode mode) noexcept(false) {
+    if ((long)image.GetRows() * image.GetCols() > MAX_PACKED_PIXELS){
+        throw MatrixException(SIZE_ERROR);
+    }
+    PackedImage packed;
+    packed.rows_ = image.GetRows();
+    packed.cols_ = image.GetCols();
+    std::vector<uint8_t> indices;
+    BuildPalette(image, packed.palette_, indices);
+    int levels = (int)packed.palette_.size();
+    packed.bits_ = BitsFor(levels);
+    size_t count = (size_t)packed.rows_ * packed.cols_;
+
+    // AUTO tries every mode and keeps the smallest, BITS on a tie since it
+    // is the fastest to unpack
+    if (mode == PackingMode::AUTO || mode == PackingMode::BITS){
+        packed.data_ = PackBits(indices, packed.bits_);
+        packed.mode_ = PackingMode::BITS;
+    }
+    if (mode == PackingMode::AUTO || mode == PackingMode::RLE){
+        std::vector<uint8_t> data = EncodeRuns(indices, count);
+        if (mode == PackingMode::RLE || data.size() < packed.data_.size()){
+            packed.data_ = std::move(data);
+            packed.mode_ = PackingMode::RLE;
+        }
+    }
+    if (mode == PackingMode::AUTO || mode == PackingMode::RLE_DELTA){
+        ToRowDeltas(indices, packed.rows_, packed.cols_, levels);
+        std::vector<uint8_t> data = EncodeRuns(indices, count);
+        if (mode == PackingMode::RLE_DELTA || data.size() < packed.data_.size()){
+            packed.data_ = std::move(data);
+            packed.mode_ = PackingMode::RLE_DELTA;
+        }
+    }
+    return packed;
+}
+
+Matrix PackedImage::Unpack() const noexcept(false) {
+    int levels = (int)palette_.size();
+    size_t count = (size_t)rows_ * cols_;
+    std::vector<uint8_t> indices((count + GROUP_PIXELS - 1) / GROUP_PIXELS * GROUP_PIXELS);
+    if (mode_ == PackingMode::BITS){
+        UnpackBits(data_, bits_, indices);
+    }
+    else{
+        DecodeRuns(data_, count, indices);
+    }
+
+    // Indices out of the palette (or deltas) only come from corrupt data
+    for (size_t k = 0; k < count; k++){
+        if (indices[k] >= levels){
+            throw MatrixException(FORMAT_ERROR);
+        }
+    }
+    if (mode_ == PackingMode::RLE_DELTA){
+        FromRowDeltas(indices, rows_, cols_, levels);
+    }
+
+    Matrix image(rows_, cols_);
+    const float *palette = palette_.data();
+    ParallelRows(rows_, cols_, [&](int first, int last){
+        for (int i = first; i < last; i++){
+            float *row = image.Row(i);
+            const uint8_t *index = &indices[(size_t)i * cols_];
+            for (int j = 0; j < cols_; j++){
+                row[j] = palette[index[j]];
+            }
+        }
+    });
+    return image;
+}
+
+int PackedImage::GetRows() const noexcept {
+    return this->rows_;
+}
+
+int PackedImage::GetCols() const noexcept {
+    return this->cols_;
+}
+
+const std::vector<float> &PackedImage::GetPalette() const noexcept {
+    return this->palette_;
+}
+
+int PackedImage::GetBits() const noexcept {
+    return this->bits_;
+}
+
+PackingMode PackedImage::GetMode() const noexcept {
+    return this->mode_;
+}
+
+size_t PackedImage::GetDataSize() const noexcept {
+    return this->data_.size();
+}
+
+void PackedImage::Write(std::ostream &output) const noexcept(false) {
+    char header[8] = {PACKED_MAGIC[0], PACKED_MAGIC[1], PACKED_MAGIC[2], PACKED_MAGIC[3],
+                      PACKED_VERSION, (char)mode_, (char)bits_, 0};
+    output.write(header, sizeof(header));
+    PutU32(output, (uint32_t)rows_);
+    PutU32(output, (uint32_t)cols_);
+    char levels[2] = {(char)(palette_.size() & 0xff), (char)(palette_.size() >> 8)};
+    output.write(levels, sizeof(levels));
+    for (float value : palette_){
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        PutU32(output, bits);
+    }
+    PutU32(output, (uint32_t)data_.size());
+    output.write((const char *)data_.data(), (std::streamsize)data_.size());
+    if (!output.good()){
+        throw MatrixException(STREAM_ERROR);
+    }
+}
+
+PackedImage PackedImage::Read(std::istream &input) noexcept(false) {
+    char header[8];
+    input.read(header, sizeof(header));
+    if (!input.good() || std::memcmp(header, PACKED_MAGIC, 4) != 0 || header[4] != PACKED_VERSION){
+        throw MatrixException(FORMAT_ERROR);
+    }
+    PackedImage packed;
+    int mode = header[5];
+    packed.bits_ = header[6];
+    if (mode < (int)PackingMode::BITS || mode > (int)PackingMode::RLE_DELTA
+        || packed.bits_ < 1 || packed.bits_ > 8){
+        throw MatrixException(FORMAT_ERROR);
+    }
+    packed.mode_ = (PackingMode)mode;
+
+    uint32_t rows = GetU32(input);
+    uint32_t cols = GetU32(input);
+    unsigned char levels[2] = {};
+    input.read((char *)levels, sizeof(levels));
+    int count = levels[0] | (levels[1] << 8);
+    if (!input.good() || rows == 0 || cols == 0 || (uint64_t)rows * cols > MAX_PACKED_PIXELS
+        || count < 1 || count > MAX_PALETTE || BitsFor(count) != packed.bits_){
+        throw MatrixException(FORMAT_ERROR);
+    }
+    packed.rows_ = (int)rows;
+    packed.cols_ = (int)cols;
+    packed.palette_.resize(count);
+    for (float &value : packed.palette_){
+        uint32_t bits = GetU32(input);
+        std::memcpy(&value, &bits, sizeof(value));
+    }
+
+    uint32_t size = GetU32(input);
+    if (!input.good()){
+        throw MatrixException(STREAM_ERROR);
+    }
+
+    // The size of BITS data follows from the dimensions, a run takes at
+    // least 2 bytes and at most 2 bytes per pixel it covers
+    size_t pixels = (size_t)rows * cols;
+    size_t groups = (pixels + GROUP_PIXELS - 1) / GROUP_PIXELS;
+    bool valid = (packed.mode_ == PackingMode::BITS) ? (size == groups * packed.bits_)
+                                                     : (size >= 2 && size <= 2 * pixels);
+    if (!valid){
+        throw MatrixException(FORMAT_ERROR);
+    }
+    while (packed.data_.size() < size){
+        size_t start = packed.data_.size();
+        size_t chunk = std::min((size_t)READ_CHUNK, size - start);
+        packed.data_.resize(start + chunk);
+        input.read((char *)&packed.data_[start], (std::streamsize)chunk);
+        if ((size_t)input.gcount() != chunk){
+            throw MatrixException(STREAM_ERROR);
+        }
+    }
+    return packed;
+}
@@ -0,0 +1,114 @@
+#ifndef SOL_PACKED_IMAGE_H
+#define SOL_PACKED_IMAGE_H
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "Matrix.h"
+
+// The most distinct values an image may have to be packed, an index fits a byte
+#define MAX_PALETTE 256
+
+// The most pixels a packed image may have (8192 x 8192), which bounds what
+// a packed file can make a reader allocate
+#define MAX_PACKED_PIXELS (1L << 26)
+
+/**
+ * How the palette indices of a packed image are stored.
+ */
+enum class PackingMode {
+    AUTO,       // the smallest of the others
+    BITS,       // every index takes as many bits as the palette needs
+    RLE,        // runs of equal indices, row after row
+    RLE_DELTA   // runs of the differences from the row above
+};
+
+/**
+ * A compact image with few distinct values, such as the result of
+ * Quantization: the distinct values form a palette, and every pixel is
+ * stored as the index of its value. With 8 levels a pixel takes 3 bits
+ * instead of a float (or about 4 characters of text), and flat regions
+ * compress further with run length encoding.
+ *
+ * On disk: "MQPK", a version byte, the mode, the bits per index and a zero
+ * byte; the rows and columns (32 bit); the size of the palette (16 bit)
+ * and its values (32 bit floats); the size of the data (32 bit) and the
+ * data. All the integers are little endian.
+ */
+class PackedImage {
+
+private:
+
+    int rows_;
+    int cols_;
+    std::vector<float> palette_;  // in the order of their first pixel
+    int bits_;  // bits per index in BITS mode
+    PackingMode mode_;
+    std::vector<uint8_t> data_;
+
+    PackedImage() noexcept;
+
+public:
+
+    /**
+     * Packs an image.
+     * @param image a matrix with at most MAX_PALETTE distinct values, and
+     * at most MAX_PACKED_PIXELS elements
+     * @param mode how to store the indices
+     * @return the packed image.
+     */
+    static PackedImage Pack(const Matrix &image, PackingMode mode = PackingMode::AUTO) noexcept(false);
+
+    /**
+     * @return a new matrix with the pixels of the image.
+     */
+    Matrix Unpack() const noexcept(false);
+
+    /**
+     * @return the amount of rows (int).
+     */
+    int GetRows() const noexcept;
+
+    /**
+     * @return the amount of columns (int).
+     */
+    int GetCols() const noexcept;
+
+    /**
+     * @return the distinct values of the image, in the order of their first pixel.
+     */
+    const std::vector<float>& GetPalette() const noexcept;
+
+    /**
+     * @return the bits per pixel of the BITS mode.
+     */
+    int GetBits() const noexcept;
+
+    /**
+     * @return the mode the indices are stored in (never AUTO).
+     */
+    PackingMode GetMode() const noexcept;
+
+    /**
+     * @return the size of the packed indices in bytes.
+     */
+    size_t GetDataSize() const noexcept;
+
+    /**
+     * Writes the packed image in its binary format.
+     * @param output (std::ostream &) opened in binary mode
+     */
+    void Write(std::ostream &output) const noexcept(false);
+
+    /**
+     * Reads a packed image in its binary format. The header is checked
+     * before anything is allocated, and the data is read as it arrives,
+     * so a corrupt or truncated file throws rather than allocating what
+     * its header claims.
+     * @param input (std::istream &) opened in binary mode
+     * @return the packed image.
+     */
+    static PackedImage Read(std::istream &input) noexcept(false);
+};
+
+#endif //SOL_PACKED_IMAGE_H
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <utility>
+#include "Pipeline.h"
+#include "MatrixException.h"
+
+#define DIMENSION_ERROR "Invalid matrix dimensions.\n"
+#define BUFFERS_ERROR "Invalid number of buffers.\n"
+#define WORKERS_ERROR "Invalid number of workers.\n"
+
+// -------- Private functions --------
+
+void Pipeline::Clear(Matrix &buffer) const noexcept(false) {
+    if (buffer.GetRows() != rows_ || buffer.GetCols() != cols_){
+        buffer = Matrix(rows_, cols_);
+        return;
+    }
+    for (int i = 0; i < rows_; i++){
+        float *row = buffer.Row(i);
+        std::fill(row, row + cols_, 0.0f);
+    }
+}
+
+// -------- End of private functions --------
+
+Pipeline::Pipeline(Reader read, Filter filter, Writer write, int rows, int cols,
+                   int buffers, int workers) noexcept(false) {
+    if (rows <= 0 or cols <= 0){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    if (buffers <= 0){
+        throw MatrixException(BUFFERS_ERROR);
+    }
+    if (workers <= 0){
+        throw MatrixException(WORKERS_ERROR);
+    }
+    this->read_ = std::move(read);
+    this->filter_ = std::move(filter);
+    this->write_ = std::move(write);
+    this->rows_ = rows;
+    this->cols_ = cols;
+    this->buffers_ = buffers;
+    this->workers_ = workers;
+}
+
+int Pipeline::Run(const std::function<bool(PipelineJob&)> &next) noexcept(false) {
+    std::vector<Slot> slots(buffers_);
+    for (Slot &slot : slots){
+        slot.input = Matrix(rows_, cols_);
+    }
+
+    // Buffers circulate by index: free -> read -> filtered -> free
+    BoundedQueue<int> free(buffers_);
+    BoundedQueue<int> read(buffers_);
+    BoundedQueue<int> filtered(buffers_);
+    for (int s = 0; s < buffers_; s++){
+        free.Push(s);
+    }
+    std::atomic<int> failures{0};
+    std::exception_ptr error;
+
+    std::thread reader([&]{
+        try{
+            PipelineJob job;
+            int s;
+            while (next(job) && free.Pop(s)){
+                Slot &slot = slots[s];
+                slot.job = std::move(job);
+                bool ok;
+                try{
+                    Clear(slot.input);
+                    ok = read_(slot.job.input, slot.input);
+                } catch (...) {
+                    ok = false;
+                }
+                if (ok){
+                    read.Push(s);
+                }
+                else{
+                    failures++;
+                    free.Push(s);
+                }
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        read.Close();
+    });
+
+    std::atomic<int> running{workers_};
+    std::vector<std::thread> workers;
+    for (int w = 0; w < workers_; w++){
+        workers.emplace_back([&]{
+            int s;
+            while (read.Pop(s)){
+                Slot &slot = slots[s];
+                try{
+                    // The slot takes the elements of the result, the
+                    // previous ones are freed with it
+                    Matrix result = filter_(slot.input);
+                    std::swap(slot.output, result);
+                    filtered.Push(s);
+                } catch (...) {
+                    failures++;
+                    free.Push(s);
+                }
+            }
+            if (--running == 0){
+                filtered.Close();
+            }
+        });
+    }
+
+    // The calling thread writes
+    int s;
+    while (filtered.Pop(s)){
+        Slot &slot = slots[s];
+        bool ok;
+        try{
+            ok = write_(slot.job.output, slot.output);
+        } catch (...) {
+            ok = false;
+        }
+        if (!ok){
+            failures++;
+        }
+        free.Push(s);
+    }
+
+    reader.join();
+    for (std::thread &worker : workers){
+        worker.join();
+    }
+    if (error){
+        std::rethrow_exception(error);
+    }
+    return failures;
+}
+
+int Pipeline::Run(const std::vector<PipelineJob> &jobs) noexcept(false) {
+    size_t i = 0;
+    return Run([&](PipelineJob &job){
+        if (i == jobs.size()){
+            return false;
+        }
+        job = jobs[i++];
+        return true;
+    });
+}
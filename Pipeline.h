@@ -0,0 +1,181 @@
+#ifndef SOL_PIPELINE_H
+#define SOL_PIPELINE_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Matrix.h"
+
+// The amount of images a pipeline holds at once, between reading and writing
+#define PIPELINE_BUFFERS 8
+
+// The amount of images filtered at once. The filters spread over the cores
+// through the shared thread pool themselves, a second worker keeps them busy
+// while the first one is between images
+#define PIPELINE_WORKERS 2
+
+/**
+ * A queue between the threads of two stages, which holds at most capacity
+ * items: a producer which is ahead waits for the consumer (back pressure).
+ */
+template <typename T>
+class BoundedQueue {
+
+private:
+
+    size_t capacity_;
+    std::deque<T> items_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+
+public:
+
+    /**
+     * @param capacity the maximal amount of items (positive)
+     */
+    explicit BoundedQueue(size_t capacity) noexcept : capacity_(capacity) {}
+
+    BoundedQueue(const BoundedQueue &queue) = delete;
+
+    BoundedQueue& operator=(const BoundedQueue &queue) = delete;
+
+    /**
+     * Adds an item, waits while the queue is full.
+     * @param item the item
+     * @return false if the queue was closed (the item is dropped), true otherwise.
+     */
+    bool Push(T item) noexcept(false) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this]{ return closed_ || items_.size() < capacity_; });
+        if (closed_){
+            return false;
+        }
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    /**
+     * Takes the oldest item, waits while the queue is empty and open.
+     * @param item set to the item
+     * @return false if the queue is closed and empty, true otherwise.
+     */
+    bool Pop(T &item) noexcept(false) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this]{ return closed_ || !items_.empty(); });
+        if (items_.empty()){
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    /**
+     * Ends the queue: the items in it are still taken, but no more are added.
+     */
+    void Close() noexcept {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+};
+
+/**
+ * An image to process: where to read it from and where to write the result.
+ */
+struct PipelineJob {
+    std::string input;
+    std::string output;
+};
+
+/**
+ * Processes a stream of image files in three overlapping stages: a reader
+ * thread reads the next images while workers filter the previous ones and
+ * a writer thread writes the results, so the run takes about as long as
+ * its slowest stage rather than the sum of the stages.
+ *
+ * The images live in a ring of buffers which are recycled from job to job
+ * (an image is read into the elements of the previous one, which are reset
+ * to zeros first), and a stage waits when the next one is behind, so the
+ * memory of a run doesn't depend on the amount of images.
+ */
+class Pipeline {
+
+public:
+
+    // Reads an image file into a matrix of the dimensions of the pipeline,
+    // all zeros, returns false on failure (also when the file is short)
+    typedef std::function<bool(const std::string&, Matrix&)> Reader;
+
+    // Returns the result of the filter on an image
+    typedef std::function<Matrix(const Matrix&)> Filter;
+
+    // Writes a matrix to an image file, returns false on failure
+    typedef std::function<bool(const std::string&, const Matrix&)> Writer;
+
+private:
+
+    /**
+     * A buffer of the ring, with the job it currently holds.
+     */
+    struct Slot {
+        PipelineJob job;
+        Matrix input;
+        Matrix output;
+    };
+
+    Reader read_;
+    Filter filter_;
+    Writer write_;
+    int rows_;
+    int cols_;
+    int buffers_;
+    int workers_;
+
+    /**
+     * Resets a buffer to zeros and to the dimensions of the pipeline, so
+     * nothing of the previous image is left in it.
+     */
+    void Clear(Matrix &buffer) const noexcept(false);
+
+public:
+
+    /**
+     * @param read reads an image, called by the reader thread only
+     * @param filter filters an image, called by the workers concurrently
+     * @param write writes an image, called by the writer thread only
+     * @param rows the rows of the buffers images are read into
+     * @param cols the columns of the buffers images are read into
+     * @param buffers the amount of images in the pipeline at once (positive)
+     * @param workers the amount of filtering threads (positive)
+     */
+    Pipeline(Reader read, Filter filter, Writer write, int rows, int cols,
+             int buffers = PIPELINE_BUFFERS, int workers = PIPELINE_WORKERS) noexcept(false);
+
+    /**
+     * Processes jobs until next returns false. An image which can't be
+     * read, filtered or written (the function returns false or throws
+     * anything) is skipped and counted.
+     * @param next sets its argument to the next job, returns false when
+     * there are no more jobs; called by the reader thread only
+     * @return the amount of images which failed.
+     */
+    int Run(const std::function<bool(PipelineJob&)> &next) noexcept(false);
+
+    /**
+     * Processes the given jobs.
+     * @param jobs the jobs
+     * @return the amount of images which failed.
+     */
+    int Run(const std::vector<PipelineJob> &jobs) noexcept(false);
+};
+
+#endif //SOL_PIPELINE_H
@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cmath>
+#include "Pyramid.h"
+#include "MatrixException.h"
+#include "ThreadPool.h"
+
+#define LEVELS_ERROR "Invalid number of levels.\n"
+#define DIMENSION_ERROR "Invalid matrix dimensions.\n"
+
+// -------- Static (helper) functions --------
+
+/**
+ * @param base the first element of rows x cols elements stored row by row
+ * @return pointers to the rows.
+ */
+static std::vector<float *> RowsOf(float *base, int rows, int cols){
+    std::vector<float *> pointers(rows);
+    for (int i = 0; i < rows; i++){
+        pointers[i] = base + (size_t)i * cols;
+    }
+    return pointers;
+}
+
+/**
+ * @param image a matrix
+ * @return pointers to the rows of the matrix.
+ */
+static std::vector<const float *> RowsOf(const Matrix& image){
+    std::vector<const float *> pointers(image.GetRows());
+    for (int i = 0; i < image.GetRows(); i++){
+        pointers[i] = image.Row(i);
+    }
+    return pointers;
+}
+
+/**
+ * @param image a matrix
+ * @return pointers to the rows of the matrix.
+ */
+static std::vector<float *> RowsOf(Matrix& image){
+    std::vector<float *> pointers(image.GetRows());
+    for (int i = 0; i < image.GetRows(); i++){
+        pointers[i] = image.Row(i);
+    }
+    return pointers;
+}
+
+/**
+ * The fused blur and decimation: every output row blends 3 source rows
+ * into a temporary row (a loop the compiler vectorizes), and then blends
+ * every 3 elements of it around the even columns.
+ * @param src the rows of the source, rows x cols
+ * @param dst the rows of the result, (rows + 1) / 2 x (cols + 1) / 2
+ */
+static void DownsampleInto(const float *const *src, int rows, int cols, float *const *dst){
+    int out_rows = (rows + 1) / 2;
+    int out_cols = (cols + 1) / 2;
+
+    ParallelRows(out_rows, cols, [&](int first, int last){
+        std::vector<float> temp(cols);
+        for (int i = first; i < last; i++){
+            const float *above = src[std::max(2 * i - 1, 0)];
+            const float *center = src[2 * i];
+            const float *below = src[std::min(2 * i + 1, rows - 1)];
+            for (int x = 0; x < cols; x++){
+                temp[x] = 0.25f * above[x] + 0.5f * center[x] + 0.25f * below[x];
+            }
+
+            float *out = dst[i];
+            for (int j = 0; j < out_cols; j++){
+                int x = 2 * j;
+                float left = temp[std::max(x - 1, 0)];
+                float right = temp[std::min(x + 1, cols - 1)];
+                out[j] = 0.25f * left + 0.5f * temp[x] + 0.25f * right;
+            }
+        }
+    });
+}
+
+/**
+ * Bilinear resize with aligned pixel centers. The horizontal positions and
+ * weights are computed once, and every output row first blends its 2
+ * source rows into a temporary row.
+ * @param src the rows of the source, rows x cols
+ * @param dst the rows of the result, out_rows x out_cols
+ */
+static void UpsampleInto(const float *const *src, int rows, int cols,
+                         float *const *dst, int out_rows, int out_cols){
+    std::vector<int> x0(out_cols);
+    std::vector<int> x1(out_cols);
+    std::vector<float> wx(out_cols);
+    for (int j = 0; j < out_cols; j++){
+        float x = ((float)j + 0.5f) * (float)cols / (float)out_cols - 0.5f;
+        x = std::min(std::max(x, 0.0f), (float)(cols - 1));
+        x0[j] = (int)x;
+        x1[j] = std::min(x0[j] + 1, cols - 1);
+        wx[j] = x - (float)x0[j];
+    }
+
+    ParallelRows(out_rows, out_cols, [&](int first, int last){
+        std::vector<float> temp(cols);
+        for (int i = first; i < last; i++){
+            float y = ((float)i + 0.5f) * (float)rows / (float)out_rows - 0.5f;
+            y = std::min(std::max(y, 0.0f), (float)(rows - 1));
+            int y0 = (int)y;
+            float wy = y - (float)y0;
+            const float *top = src[y0];
+            const float *bottom = src[std::min(y0 + 1, rows - 1)];
+            for (int x = 0; x < cols; x++){
+                temp[x] = top[x] + wy * (bottom[x] - top[x]);
+            }
+
+            float *out = dst[i];
+            for (int j = 0; j < out_cols; j++){
+                out[j] = temp[x0[j]] + wx[j] * (temp[x1[j]] - temp[x0[j]]);
+            }
+        }
+    });
+}
+
+// -------- End of static functions --------
+
+Pyramid::Pyramid(const Matrix& image, int levels, PyramidType type) noexcept(false) {
+    if (levels <= 0){
+        throw MatrixException(LEVELS_ERROR);
+    }
+    this->type_ = type;
+
+    // Plan the sizes of the levels and their place in the allocation
+    size_t total = 0;
+    int rows = image.GetRows();
+    int cols = image.GetCols();
+    for (int k = 0; k < levels; k++){
+        rows_.push_back(rows);
+        cols_.push_back(cols);
+        offsets_.push_back(total);
+        total += (size_t)rows * cols;
+        if (rows == 1 && cols == 1){
+            break;
+        }
+        rows = (rows + 1) / 2;
+        cols = (cols + 1) / 2;
+    }
+    data_.resize(total);
+
+    // Level 0 is the image itself
+    for (int i = 0; i < image.GetRows(); i++){
+        std::copy(image.Row(i), image.Row(i) + image.GetCols(),
+                  data_.begin() + (long)((size_t)i * image.GetCols()));
+    }
+
+    for (int k = 1; k < GetLevels(); k++){
+        auto src = RowsOf(data_.data() + offsets_[k - 1], rows_[k - 1], cols_[k - 1]);
+        auto dst = RowsOf(data_.data() + offsets_[k], rows_[k], cols_[k]);
+        DownsampleInto(src.data(), rows_[k - 1], cols_[k - 1], dst.data());
+    }
+
+    if (type == PyramidType::LAPLACIAN){
+        // Level k is replaced after level k + 1 was computed from it, and
+        // level k + 1 is still gaussian when level k is replaced.
+        for (int k = 0; k + 1 < GetLevels(); k++){
+            std::vector<float> up((size_t)rows_[k] * cols_[k]);
+            auto src = RowsOf(data_.data() + offsets_[k + 1], rows_[k + 1], cols_[k + 1]);
+            auto dst = RowsOf(up.data(), rows_[k], cols_[k]);
+            UpsampleInto(src.data(), rows_[k + 1], cols_[k + 1], dst.data(), rows_[k], cols_[k]);
+
+            float *level = data_.data() + offsets_[k];
+            for (size_t e = 0; e < up.size(); e++){
+                level[e] -= up[e];
+            }
+        }
+    }
+}
+
+int Pyramid::GetLevels() const noexcept {
+    return (int)this->rows_.size();
+}
+
+PyramidType Pyramid::GetType() const noexcept {
+    return this->type_;
+}
+
+int Pyramid::GetRows(int level) const noexcept(false) {
+    if (level < 0 || level >= GetLevels()){
+        throw MatrixException(LEVELS_ERROR);
+    }
+    return this->rows_[level];
+}
+
+int Pyramid::GetCols(int level) const noexcept(false) {
+    if (level < 0 || level >= GetLevels()){
+        throw MatrixException(LEVELS_ERROR);
+    }
+    return this->cols_[level];
+}
+
+const float *Pyramid::Data(int level) const noexcept(false) {
+    if (level < 0 || level >= GetLevels()){
+        throw MatrixException(LEVELS_ERROR);
+    }
+    return this->data_.data() + this->offsets_[level];
+}
+
+Matrix Pyramid::Level(int level) const noexcept(false) {
+    Matrix result(GetRows(level), GetCols(level));
+    const float *data = Data(level);
+    for (int i = 0; i < result.GetRows(); i++){
+        std::copy(data + (size_t)i * result.GetCols(), data + (size_t)(i + 1) * result.GetCols(),
+                  result.Row(i));
+    }
+    return result;
+}
+
+Matrix Pyramid::Reconstruct() const noexcept(false) {
+    if (type_ == PyramidType::GAUSSIAN){
+        return Level(0);
+    }
+
+    Matrix result = Level(GetLevels() - 1);
+    for (int k = GetLevels() - 2; k >= 0; k--){
+        result = Upsample(result, rows_[k], cols_[k]);
+        const float *level = Data(k);
+        for (int i = 0; i < rows_[k]; i++){
+            float *row = result.Row(i);
+            for (int j = 0; j < cols_[k]; j++){
+                row[j] += level[(size_t)i * cols_[k] + j];
+            }
+        }
+    }
+    return result;
+}
+
+Matrix Downsample(const Matrix& image) noexcept(false) {
+    Matrix result((image.GetRows() + 1) / 2, (image.GetCols() + 1) / 2);
+    auto src = RowsOf(image);
+    auto dst = RowsOf(result);
+    DownsampleInto(src.data(), image.GetRows(), image.GetCols(), dst.data());
+    return result;
+}
+
+Matrix Upsample(const Matrix& image, int rows, int cols) noexcept(false) {
+    if (rows <= 0 || cols <= 0){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    Matrix result(rows, cols);
+    auto src = RowsOf(image);
+    auto dst = RowsOf(result);
+    UpsampleInto(src.data(), image.GetRows(), image.GetCols(), dst.data(), rows, cols);
+    return result;
+}
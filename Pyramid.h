@@ -0,0 +1,103 @@
+#ifndef SOL_PYRAMID_H
+#define SOL_PYRAMID_H
+
+#include <vector>
+#include "Matrix.h"
+
+/**
+ * GAUSSIAN - every level is the previous level blurred and decimated by 2.
+ * LAPLACIAN - every level is the difference between the gaussian level and
+ * the upsampled next gaussian level, the last level is the last gaussian
+ * level.
+ */
+enum class PyramidType { GAUSSIAN, LAPLACIAN };
+
+/**
+ * A multi scale representation of an image. Level 0 has the size of the
+ * image, and every level has half the rows and the columns (rounded up)
+ * of the level below it. All the levels are stored in one contiguous
+ * allocation, level after level, each level row by row.
+ */
+class Pyramid {
+
+private:
+
+    std::vector<float> data_;
+    std::vector<int> rows_;
+    std::vector<int> cols_;
+    std::vector<size_t> offsets_;
+    PyramidType type_;
+
+public:
+
+    /**
+     * Constructs the pyramid of the image.
+     * @param image a matrix
+     * @param levels the maximal number of levels (positive), the pyramid
+     * stops earlier when a level is a single pixel.
+     * @param type gaussian or laplacian
+     */
+    Pyramid(const Matrix& image, int levels,
+            PyramidType type = PyramidType::GAUSSIAN) noexcept(false);
+
+    /**
+     * @return the amount of levels (int).
+     */
+    int GetLevels() const noexcept;
+
+    /**
+     * @return the type of the pyramid.
+     */
+    PyramidType GetType() const noexcept;
+
+    /**
+     * @param level an integer
+     * @return the amount of rows of the level.
+     */
+    int GetRows(int level) const noexcept(false);
+
+    /**
+     * @param level an integer
+     * @return the amount of columns of the level.
+     */
+    int GetCols(int level) const noexcept(false);
+
+    /**
+     * @param level an integer
+     * @return a pointer to the first element of the level, its rows are
+     * stored one after the other.
+     */
+    const float* Data(int level) const noexcept(false);
+
+    /**
+     * @param level an integer
+     * @return a new matrix with the elements of the level.
+     */
+    Matrix Level(int level) const noexcept(false);
+
+    /**
+     * Collapses the pyramid back into an image: a gaussian pyramid returns
+     * level 0, a laplacian pyramid adds the levels up from the top.
+     * @return a new matrix of the size of level 0.
+     */
+    Matrix Reconstruct() const noexcept(false);
+};
+
+/**
+ * Blurs the image with the separable [1 2 1] / 4 kernel and keeps every
+ * second row and column, in a single pass. The borders are replicated.
+ * @param image a matrix
+ * @return a new matrix with (rows + 1) / 2 rows and (cols + 1) / 2 columns.
+ */
+Matrix Downsample(const Matrix& image) noexcept(false);
+
+/**
+ * Resizes the image with bilinear interpolation, pixel centers are aligned.
+ * @param image a matrix
+ * @param rows the rows of the result (positive)
+ * @param cols the columns of the result (positive)
+ * @return a new matrix rows x cols.
+ */
+Matrix Upsample(const Matrix& image, int rows, int cols) noexcept(false);
+
+#endif //SOL_PYRAMID_H
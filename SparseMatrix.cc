@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include "SparseMatrix.h"
+#include "MatrixException.h"
+#include "ThreadPool.h"
+
+#define DIMENSION_ERROR "Invalid matrix dimensions.\n"
+#define INDEX_RANGE_ERROR "Index out of range.\n"
+#define THRESHOLD_ERROR "Invalid threshold.\n"
+
+// -------- Private functions --------
+
+void SparseMatrix::ForEachBand(int weight, const std::function<void(int, int)> &body) const noexcept(false) {
+    // Every row costs its non zeros plus one
+    long work = (long)GetNonZeros() + rows_;
+    if (work * weight < PARALLEL_MIN_ELEMENTS){
+        body(0, rows_);
+        return;
+    }
+    int bands = (int)std::min((long)rows_, (work * weight + PARALLEL_CHUNK_ELEMENTS - 1) / PARALLEL_CHUNK_ELEMENTS);
+
+    // The first row of a band is the first row whose work before it reaches
+    // the share of the bands before; the work before row i increases with i
+    auto band_start = [&](int band){
+        long target = work * band / bands;
+        int low = 0;
+        int high = rows_;
+        while (low < high){
+            int mid = low + (high - low) / 2;
+            if ((long)row_starts_[mid] + mid < target){
+                low = mid + 1;
+            }
+            else{
+                high = mid;
+            }
+        }
+        return low;
+    };
+
+    ThreadPool::Shared().ParallelFor(0, bands, 1, [&](int first, int last){
+        for (int band = first; band < last; band++){
+            int begin = band_start(band);
+            int end = band_start(band + 1);
+            if (begin < end){
+                body(begin, end);
+            }
+        }
+    });
+}
+
+// -------- End of private functions --------
+
+SparseMatrix::SparseMatrix(int rows, int cols) noexcept(false) {
+    if (rows <= 0 or cols <= 0){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    this->rows_ = rows;
+    this->cols_ = cols;
+    this->row_starts_.assign(rows + 1, 0);
+}
+
+SparseMatrix SparseMatrix::FromDense(const Matrix &m, float threshold) noexcept(false) {
+    if (!(threshold >= 0)){
+        throw MatrixException(THRESHOLD_ERROR);
+    }
+    int rows = m.GetRows();
+    int cols = m.GetCols();
+    SparseMatrix s(rows, cols);
+
+    // Count the non zeros of every row, then fill the rows in place
+    ParallelRows(rows, cols, [&](int first, int last){
+        for (int i = first; i < last; i++){
+            const float *row = m.Row(i);
+            int count = 0;
+            for (int j = 0; j < cols; j++){
+                count += std::fabs(row[j]) > threshold;
+            }
+            s.row_starts_[i + 1] = count;
+        }
+    });
+    for (int i = 0; i < rows; i++){
+        s.row_starts_[i + 1] += s.row_starts_[i];
+    }
+    s.col_indices_.resize(s.row_starts_[rows]);
+    s.values_.resize(s.row_starts_[rows]);
+
+    ParallelRows(rows, cols, [&](int first, int last){
+        for (int i = first; i < last; i++){
+            const float *row = m.Row(i);
+            int k = s.row_starts_[i];
+            for (int j = 0; j < cols; j++){
+                if (std::fabs(row[j]) > threshold){
+                    s.col_indices_[k] = j;
+                    s.values_[k] = row[j];
+                    k++;
+                }
+            }
+        }
+    });
+    return s;
+}
+
+SparseMatrix SparseMatrix::FromTriplets(int rows, int cols, const std::vector<Triplet> &triplets) noexcept(false) {
+    SparseMatrix s(rows, cols);
+
+    // Bucket the elements by row
+    std::vector<int> starts(rows + 1, 0);
+    for (const Triplet &t : triplets){
+        if ((t.row < 0) || (t.row >= rows) || (t.col < 0) || (t.col >= cols)){
+            throw MatrixException(INDEX_RANGE_ERROR);
+        }
+        starts[t.row + 1]++;
+    }
+    for (int i = 0; i < rows; i++){
+        starts[i + 1] += starts[i];
+    }
+    std::vector<std::pair<int, float>> entries(triplets.size());
+    std::vector<int> next(starts.begin(), starts.end() - 1);
+    for (const Triplet &t : triplets){
+        entries[next[t.row]++] = std::make_pair(t.col, t.value);
+    }
+
+    // Sort every row by column and sum the duplicates
+    s.col_indices_.reserve(triplets.size());
+    s.values_.reserve(triplets.size());
+    for (int i = 0; i < rows; i++){
+        auto begin = entries.begin() + starts[i];
+        auto end = entries.begin() + starts[i + 1];
+        std::sort(begin, end, [](const std::pair<int, float> &a, const std::pair<int, float> &b){
+            return a.first < b.first;
+        });
+        for (auto it = begin; it != end; ++it){
+            if (it != begin && it->first == s.col_indices_.back()){
+                s.values_.back() += it->second;
+            }
+            else{
+                s.col_indices_.push_back(it->first);
+                s.values_.push_back(it->second);
+            }
+        }
+        s.row_starts_[i + 1] = (int)s.col_indices_.size();
+    }
+    return s;
+}
+
+std::vector<Triplet> SparseMatrix::ToTriplets() const noexcept(false) {
+    std::vector<Triplet> triplets;
+    triplets.reserve(values_.size());
+    for (int i = 0; i < rows_; i++){
+        for (int k = row_starts_[i]; k < row_starts_[i + 1]; k++){
+            triplets.push_back({i, col_indices_[k], values_[k]});
+        }
+    }
+    return triplets;
+}
+
+Matrix SparseMatrix::ToDense() const noexcept(false) {
+    Matrix m(rows_, cols_);
+    for (int i = 0; i < rows_; i++){
+        float *row = m.Row(i);
+        for (int k = row_starts_[i]; k < row_starts_[i + 1]; k++){
+            row[col_indices_[k]] = values_[k];
+        }
+    }
+    return m;
+}
+
+int SparseMatrix::GetRows() const noexcept {
+    return this->rows_;
+}
+
+int SparseMatrix::GetCols() const noexcept {
+    return this->cols_;
+}
+
+int SparseMatrix::GetNonZeros() const noexcept {
+    return (int)this->values_.size();
+}
+
+const std::vector<int> &SparseMatrix::RowStarts() const noexcept {
+    return this->row_starts_;
+}
+
+const std::vector<int> &SparseMatrix::ColIndices() const noexcept {
+    return this->col_indices_;
+}
+
+const std::vector<float> &SparseMatrix::Values() const noexcept {
+    return this->values_;
+}
+
+float SparseMatrix::operator()(int i, int j) const noexcept(false) {
+    if ((i < 0) || (i >= this->rows_) || (j < 0) || (j >= this->cols_)){
+        throw MatrixException(INDEX_RANGE_ERROR);
+    }
+    auto begin = col_indices_.begin() + row_starts_[i];
+    auto end = col_indices_.begin() + row_starts_[i + 1];
+    auto it = std::lower_bound(begin, end, j);
+    if (it == end || *it != j){
+        return 0;
+    }
+    return values_[it - col_indices_.begin()];
+}
+
+Matrix SparseMatrix::operator*(const Matrix &rhs) const noexcept(false) {
+    if (this->cols_ != rhs.GetRows()){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    int cols = rhs.GetCols();
+    Matrix res(rows_, cols);
+
+    ForEachBand(cols, [&](int first, int last){
+        for (int i = first; i < last; i++){
+            float *out = res.Row(i);
+            for (int k = row_starts_[i]; k < row_starts_[i + 1]; k++){
+                const float *src = rhs.Row(col_indices_[k]);
+                float v = values_[k];
+                for (int x = 0; x < cols; x++){
+                    out[x] += v * src[x];
+                }
+            }
+        }
+    });
+    return res;
+}
+
+std::vector<float> SparseMatrix::operator*(const std::vector<float> &x) const noexcept(false) {
+    if ((int)x.size() != this->cols_){
+        throw MatrixException(DIMENSION_ERROR);
+    }
+    std::vector<float> y(rows_);
+
+    ForEachBand(1, [&](int first, int last){
+        for (int i = first; i < last; i++){
+            float sum = 0;
+            for (int k = row_starts_[i]; k < row_starts_[i + 1]; k++){
+                sum += values_[k] * x[col_indices_[k]];
+            }
+            y[i] = sum;
+        }
+    });
+    return y;
+}
@@ -0,0 +1,134 @@
+#ifndef SOL_SPARSE_MATRIX_H
+#define SOL_SPARSE_MATRIX_H
+
+#include <functional>
+#include <vector>
+#include "Matrix.h"
+
+/**
+ * One non zero element of a sparse matrix in coordinate (COO) form.
+ */
+struct Triplet {
+    int row;
+    int col;
+    float value;
+};
+
+/**
+ * A sparse matrix in compressed sparse row (CSR) form: the non zeros of
+ * row i are values_[k] at the columns col_indices_[k], for k in
+ * [row_starts_[i], row_starts_[i + 1]), ordered by column. The memory and
+ * the cost of the products are proportional to the non zeros (and rows).
+ */
+class SparseMatrix {
+
+private:
+
+    int rows_;
+    int cols_;
+    std::vector<int> row_starts_;
+    std::vector<int> col_indices_;
+    std::vector<float> values_;
+
+    /**
+     * Runs body on bands of rows [begin, end) with about the same amount of
+     * non zeros each, on the shared pool. Small matrices are processed
+     * serially by the calling thread.
+     * @param weight the cost of a non zero (or a row) for body
+     */
+    void ForEachBand(int weight, const std::function<void(int, int)> &body) const noexcept(false);
+
+public:
+
+    /**
+     * Constructs sparse matrix rows * cols without non zeros.
+     * @param rows number of rows
+     * @param cols number of columns
+     */
+    SparseMatrix(int rows, int cols) noexcept(false);
+
+    /**
+     * Converts a dense matrix, keeping the elements whose absolute value is
+     * greater than the threshold.
+     * @param m a matrix
+     * @param threshold non negative, 0 keeps all the non zeros
+     * @return a new sparse matrix.
+     */
+    static SparseMatrix FromDense(const Matrix &m, float threshold = 0) noexcept(false);
+
+    /**
+     * Converts coordinate form, in any order. Elements with the same row
+     * and column are summed.
+     * @param rows number of rows
+     * @param cols number of columns
+     * @param triplets the elements
+     * @return a new sparse matrix.
+     */
+    static SparseMatrix FromTriplets(int rows, int cols, const std::vector<Triplet> &triplets) noexcept(false);
+
+    /**
+     * @return the non zeros in coordinate form, row by row.
+     */
+    std::vector<Triplet> ToTriplets() const noexcept(false);
+
+    /**
+     * @return a new dense matrix with the elements.
+     */
+    Matrix ToDense() const noexcept(false);
+
+    /**
+     * @return the amount of rows (int).
+     */
+    int GetRows() const noexcept;
+
+    /**
+     * @return the amount of columns (int).
+     */
+    int GetCols() const noexcept;
+
+    /**
+     * @return the amount of stored non zeros (int).
+     */
+    int GetNonZeros() const noexcept;
+
+    /**
+     * @return the start of every row in ColIndices() and Values(), rows + 1 integers.
+     */
+    const std::vector<int>& RowStarts() const noexcept;
+
+    /**
+     * @return the column of every non zero.
+     */
+    const std::vector<int>& ColIndices() const noexcept;
+
+    /**
+     * @return the value of every non zero.
+     */
+    const std::vector<float>& Values() const noexcept;
+
+    /**
+     * Parenthesis indexing, by binary search in the row.
+     * @param i an integer
+     * @param j an integer
+     * @return the element (i, j), 0 if it isn't stored.
+     */
+    float operator()(int i, int j) const noexcept(false);
+
+    /**
+     * Sparse - dense multiplication, every row of the result combines the
+     * rows of rhs picked by the non zeros of a row of this.
+     * @param rhs (Matrix &) with a row for every column of this
+     * @return a new dense matrix which is this * rhs.
+     */
+    Matrix operator*(const Matrix &rhs) const noexcept(false);
+
+    /**
+     * Sparse matrix - vector multiplication (SpMV), parallel over bands of
+     * rows with balanced non zeros.
+     * @param x a vector with an element for every column of this
+     * @return a new vector which is this * x.
+     */
+    std::vector<float> operator*(const std::vector<float> &x) const noexcept(false);
+};
+
+#endif //SOL_SPARSE_MATRIX_H
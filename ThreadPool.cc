@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include "ThreadPool.h"
+#include "MatrixException.h"
+
+#define THREADS_ERROR "Invalid number of threads.\n"
+#define GRAIN_ERROR "Invalid parallel grain.\n"
+
+/**
+ * The state of one ParallelFor call, shared by every thread which
+ * takes chunks of it.
+ */
+struct ParallelJob {
+    int first;
+    int last;
+    int grain;
+    int chunks;
+    const std::function<void(int, int)> *body;
+    std::atomic<int> next{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+    int completed = 0;
+    std::exception_ptr error;
+};
+
+// -------- Static (helper) functions --------
+
+/**
+ * Takes chunks of the job and runs them until no chunk is left.
+ * @param job the job
+ */
+static void RunChunks(ParallelJob &job) noexcept {
+    for (int c = job.next++; c < job.chunks; c = job.next++){
+        int begin = job.first + c * job.grain;
+        int end = (job.last - begin < job.grain) ? job.last : begin + job.grain;
+
+        std::exception_ptr error;
+        try{
+            (*job.body)(begin, end);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(job.mutex);
+        if (error && !job.error){
+            job.error = error;
+        }
+        if (++job.completed == job.chunks){
+            job.finished.notify_all();
+        }
+    }
+}
+
+// -------- End of static functions --------
+
+// -------- Private functions --------
+
+void ThreadPool::Work() noexcept {
+    while (true){
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            available_.wait(lock, [this]{ return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()){
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+// -------- End of private functions --------
+
+ThreadPool::ThreadPool(int threads) noexcept(false) {
+    if (threads < 0){
+        throw MatrixException(THREADS_ERROR);
+    }
+    for (int t = 0; t < threads; t++){
+        workers_.emplace_back(&ThreadPool::Work, this);
+    }
+}
+
+ThreadPool &ThreadPool::Shared() noexcept(false) {
+    static ThreadPool pool((int)std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+int ThreadPool::GetThreads() const noexcept {
+    return (int)workers_.size();
+}
+
+void ThreadPool::Submit(std::function<void()> task) noexcept(false) {
+    if (workers_.empty()){
+        task();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    available_.notify_one();
+}
+
+void ThreadPool::ParallelFor(int first, int last, int grain,
+                             const std::function<void(int, int)> &body) noexcept(false) {
+    if (grain <= 0){
+        throw MatrixException(GRAIN_ERROR);
+    }
+    if (first >= last){
+        return;
+    }
+
+    int chunks = (int)(((long)last - first + grain - 1) / grain);
+    if (chunks == 1 || workers_.empty()){
+        body(first, last);
+        return;
+    }
+
+    auto job = std::make_shared<ParallelJob>();
+    job->first = first;
+    job->last = last;
+    job->grain = grain;
+    job->chunks = chunks;
+    job->body = &body;
+
+    // Helpers which start after all the chunks were taken return at once,
+    // the job stays alive until the last of them drops its reference.
+    int helpers = std::min(chunks - 1, GetThreads());
+    for (int h = 0; h < helpers; h++){
+        Submit([job]{ RunChunks(*job); });
+    }
+    RunChunks(*job);
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->finished.wait(lock, [&job]{ return job->completed == job->chunks; });
+    if (job->error){
+        std::rethrow_exception(job->error);
+    }
+}
+
+ThreadPool::~ThreadPool() noexcept {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    available_.notify_all();
+    for (auto &worker : workers_){
+        worker.join();
+    }
+}
+
+void ParallelRows(int rows, int cols, const std::function<void(int, int)> &body) noexcept(false) {
+    if ((long)rows * cols < PARALLEL_MIN_ELEMENTS){
+        body(0, rows);
+        return;
+    }
+    int grain = std::max(1, PARALLEL_CHUNK_ELEMENTS / cols);
+    ThreadPool::Shared().ParallelFor(0, rows, grain, body);
+}
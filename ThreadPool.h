@@ -0,0 +1,92 @@
+#ifndef SOL_THREAD_POOL_H
+#define SOL_THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Matrices with less elements than this are processed serially
+#define PARALLEL_MIN_ELEMENTS 65536
+
+// Rows are scheduled in chunks of about this many elements (64KB of floats)
+#define PARALLEL_CHUNK_ELEMENTS 16384
+
+class ThreadPool {
+
+private:
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable available_;
+    bool stopping_ = false;
+
+    /**
+     * The loop of every worker thread: runs tasks until the pool stops.
+     */
+    void Work() noexcept;
+
+public:
+
+    /**
+     * Constructs a pool with the given number of worker threads.
+     * @param threads number of workers (non negative), with 0 workers every
+     * task runs on the thread which submits it.
+     */
+    explicit ThreadPool(int threads) noexcept(false);
+
+    ThreadPool(const ThreadPool &pool) = delete;
+
+    ThreadPool& operator=(const ThreadPool &pool) = delete;
+
+    /**
+     * @return the pool shared by the whole program, which has a worker for
+     * every core other than the calling one.
+     */
+    static ThreadPool& Shared() noexcept(false);
+
+    /**
+     * @return the amount of worker threads (int).
+     */
+    int GetThreads() const noexcept;
+
+    /**
+     * Queues a task to be run by one of the workers.
+     * @param task the task
+     */
+    void Submit(std::function<void()> task) noexcept(false);
+
+    /**
+     * Runs body on consecutive chunks of [first, last), each chunk at most
+     * grain long, in parallel. The calling thread takes chunks as well, so
+     * ParallelFor may be nested. Returns when all the chunks are done, and
+     * rethrows the first exception thrown by body.
+     * @param first the first index (inclusive)
+     * @param last the last index (exclusive)
+     * @param grain the maximal length of a chunk (positive)
+     * @param body a function of a chunk [begin, end)
+     */
+    void ParallelFor(int first, int last, int grain,
+                     const std::function<void(int, int)> &body) noexcept(false);
+
+    /**
+     * Stops the workers after the queued tasks are done.
+     */
+    ~ThreadPool() noexcept;
+};
+
+/**
+ * Runs body on cache sized bands of the rows [0, rows) of a rows x cols
+ * matrix, on the shared pool. Small matrices are processed serially by
+ * the calling thread. Each row belongs to exactly one band, so a body
+ * which only writes its own rows gives the same result as a serial loop.
+ * @param rows number of rows
+ * @param cols number of columns
+ * @param body a function of a band of rows [begin, end)
+ */
+void ParallelRows(int rows, int cols, const std::function<void(int, int)> &body) noexcept(false);
+
+#endif //SOL_THREAD_POOL_H
@@ -1,9 +1,20 @@
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
 #include <fstream>
 #include "Matrix.h"
 #include "Filters.h"
+#include "FilterServer.h"
+#include "MatrixException.h"
+#include "PackedImage.h"
+#include "Pipeline.h"
 
 #define MAIN
 
+#define UNSUPPORTED_SERVER "The filter server is only supported on Linux."
+
 #ifdef MAIN
 
 /**
@@ -23,8 +34,10 @@ bool readFileToMatrix(const std::string &filePath, Matrix &mat)
 		return false;
 	}
 	file >> mat;
+	// A short file, or one with something other than numbers, fails
+	bool ok = !file.fail();
 	file.close();
-	return true;
+	return ok;
 }
 
 
@@ -48,6 +61,297 @@ bool writeMatrixToFile(const std::string &filePath, const Matrix &mat)
 }
 
 
+/**
+ * @param filePath path to some file.
+ * @return true if the file is a packed image (its extension is ".qpk").
+ */
+bool isPackedFile(const std::string &filePath)
+{
+	const std::string extension = ".qpk";
+	return filePath.size() >= extension.size() &&
+		   filePath.compare(filePath.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+
+/**
+ * Reads the packed image file (given by file path) to
+ * the matrix which is referenced, whatever its dimensions are.
+ * @param filePath path to some ".qpk" file.
+ * @param mat reference to matrix.
+ * @return true if the operation succeeded, false otherwise.
+ */
+bool readPackedToMatrix(const std::string &filePath, Matrix &mat)
+{
+	std::ifstream file(filePath, std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	try
+	{
+		mat = PackedImage::Read(file).Unpack();
+	}
+	catch (const std::exception &e)
+	{
+		return false;
+	}
+	return true;
+}
+
+
+/**
+ * Writes the references matrix to the given file path as a packed image.
+ * @param filePath path to some ".qpk" file where the matrix
+ * is going to be written to.
+ * @param mat the matrix which to be written to the file, with at most
+ * 256 distinct values.
+ * @return true if the operation succeeded, false otherwise.
+ */
+bool writeMatrixToPacked(const std::string &filePath, const Matrix &mat)
+{
+	std::ofstream file(filePath, std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	try
+	{
+		PackedImage::Pack(mat).Write(file);
+	}
+	catch (const std::exception &e)
+	{
+		return false;
+	}
+	return true;
+}
+
+
+/**
+ * Reads an image file, packed or text, to the matrix which is referenced.
+ * @param filePath path to some image file.
+ * @param mat reference to matrix.
+ * @return true if the operation succeeded, false otherwise.
+ */
+bool readImage(const std::string &filePath, Matrix &mat)
+{
+	if (isPackedFile(filePath))
+	{
+		return readPackedToMatrix(filePath, mat);
+	}
+	return readFileToMatrix(filePath, mat);
+}
+
+
+/**
+ * Writes the referenced matrix to an image file, packed or text.
+ * @param filePath path to some image file.
+ * @param mat the matrix which to be written to the file.
+ * @return true if the operation succeeded, false otherwise.
+ */
+bool writeImage(const std::string &filePath, const Matrix &mat)
+{
+	if (isPackedFile(filePath))
+	{
+		return writeMatrixToPacked(filePath, mat);
+	}
+	return writeMatrixToFile(filePath, mat);
+}
+
+
+#ifdef FILTER_SERVER_SUPPORTED
+
+// The server which SIGINT and SIGTERM stop, read by the signal handler
+std::atomic<FilterServer *> runningServer{nullptr};
+static_assert(std::atomic<FilterServer *>::is_always_lock_free,
+			  "The signal handler needs a lock free pointer");
+
+
+/**
+ * Stops the running server.
+ * @param signal the signal number
+ */
+void stopServer(int signal)
+{
+	(void) signal;
+	FilterServer *server = runningServer.load();
+	if (server != nullptr)
+	{
+		server->Stop();
+	}
+}
+
+
+/**
+ * Restores the default handlers of SIGINT and SIGTERM, and forgets the
+ * running server, before it's destroyed.
+ */
+void releaseServer()
+{
+	std::signal(SIGINT, SIG_DFL);
+	std::signal(SIGTERM, SIG_DFL);
+	runningServer = nullptr;
+}
+
+#endif
+
+
+/**
+ * Serves filter requests on a Unix domain socket until SIGINT or SIGTERM.
+ * @param socketPath path of the socket.
+ * @return program exit status code
+ */
+int serve(const std::string &socketPath)
+{
+#ifdef FILTER_SERVER_SUPPORTED
+	try
+	{
+		FilterServer server(socketPath);
+		runningServer = &server;
+		std::signal(SIGINT, stopServer);
+		std::signal(SIGTERM, stopServer);
+		try
+		{
+			server.Run();
+		}
+		catch (...)
+		{
+			releaseServer();
+			throw;
+		}
+		releaseServer();
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what();
+		return 1;
+	}
+	return 0;
+#else
+	(void) socketPath;
+	std::cerr << UNSUPPORTED_SERVER << std::endl;
+	return 1;
+#endif
+}
+
+
+/**
+ * Sends an image file to a running server and writes the result.
+ * @param socketPath path of the socket of the server.
+ * @param filePath path to the input image file.
+ * @param chain the filters, separated by commas, as "quant:4,blur".
+ * @param outputFilePath path to the output image file.
+ * @return program exit status code
+ */
+int requestFromServer(const std::string &socketPath, const std::string &filePath,
+					  const std::string &chain, const std::string &outputFilePath)
+{
+#ifdef FILTER_SERVER_SUPPORTED
+	Matrix matrix(128, 128);
+	if (!readImage(filePath, matrix))
+	{
+		std::cerr << "Error reading the image file." << std::endl;
+		return 1;
+	}
+	try
+	{
+		Matrix result = RequestFilters(socketPath, chain, matrix);
+		if (!writeImage(outputFilePath, result))
+		{
+			std::cerr << "Error writing the image file." << std::endl;
+			return 1;
+		}
+	}
+	catch (const MatrixException &e)
+	{
+		std::cerr << e.what();
+		return 1;
+	}
+	return 0;
+#else
+	(void) socketPath, (void) filePath, (void) chain, (void) outputFilePath;
+	std::cerr << UNSUPPORTED_SERVER << std::endl;
+	return 1;
+#endif
+}
+
+
+/**
+ * Parses the optional parameter of a filter.
+ * @param text the argument.
+ * @param parameter set to the parameter.
+ * @return true if the argument is a whole number in the range of int,
+ * false otherwise.
+ */
+bool parseParameter(const char *text, int &parameter)
+{
+	char *end;
+	errno = 0;
+	long value = std::strtol(text, &end, 10);
+	if (end == text || *end != '\0' || errno == ERANGE || value < INT_MIN || value > INT_MAX)
+	{
+		return false;
+	}
+	parameter = (int) value;
+	return true;
+}
+
+
+/**
+ * Filters many image files through a pipeline which reads, filters and
+ * writes different images at the same time.
+ * @param listPath path to a file with a line "<input path> <output path>"
+ * for every image, or "-" for the standard input.
+ * @param chosenOperator name of the filter.
+ * @param parameter the parameter of the filter, or -1 for its default.
+ * @return program exit status code
+ */
+int filterBatch(const std::string &listPath, const std::string &chosenOperator, int parameter)
+{
+	if (!IsFilter(chosenOperator))
+	{
+		std::cerr << "Invalid operator selected." << std::endl;
+		return 1;
+	}
+	std::ifstream listFile;
+	if (listPath != "-")
+	{
+		listFile.open(listPath);
+		if (!listFile.is_open())
+		{
+			std::cerr << "Error opening the list file." << std::endl;
+			return 1;
+		}
+	}
+	std::istream &list = (listPath == "-") ? std::cin : listFile;
+
+	int failures;
+	try
+	{
+		Pipeline pipeline(readImage,
+						  [&](const Matrix &image)
+						  {
+							  return ApplyFilter(chosenOperator, image, parameter);
+						  },
+						  writeImage, 128, 128);
+		failures = pipeline.Run([&](PipelineJob &job)
+								{
+									return (bool) (list >> job.input >> job.output);
+								});
+	}
+	catch (const MatrixException &e)
+	{
+		std::cerr << e.what();
+		return 1;
+	}
+	if (failures > 0)
+	{
+		std::cerr << failures << " images failed." << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+
 /**
  * Program's main
  * @param argc count of args
@@ -56,6 +360,30 @@ bool writeMatrixToFile(const std::string &filePath, const Matrix &mat)
  */
 int main(int argc, char **argv)
 {
+	// Server mode: main --serve <socket>
+	if (argc == 3 && (std::string) argv[1] == "--serve")
+	{
+		return serve((std::string) argv[2]);
+	}
+	// Client mode: main --client <socket> <input> <filters> <output>
+	if (argc == 6 && (std::string) argv[1] == "--client")
+	{
+		return requestFromServer((std::string) argv[2], (std::string) argv[3],
+								 (std::string) argv[4], (std::string) argv[5]);
+	}
+
+	// Batch mode: main --batch <list> <filter> [parameter]
+	if ((argc == 4 || argc == 5) && (std::string) argv[1] == "--batch")
+	{
+		int parameter = -1;
+		if (argc > 4 && !parseParameter(argv[4], parameter))
+		{
+			std::cerr << "Invalid parameter." << std::endl;
+			return 1;
+		}
+		return filterBatch((std::string) argv[2], (std::string) argv[3], parameter);
+	}
+
     if (argc < 4){
         exit(1);
     }
@@ -64,32 +392,42 @@ int main(int argc, char **argv)
 	const std::string chosenOperator = (std::string) argv[2];
 	const std::string outputFilePath = (std::string) argv[3];
 
-
+	// Optional parameter of the operator: levels of "quant", radius of "median"
+	int parameter = -1;
+	if (argc > 4 && !parseParameter(argv[4], parameter))
+	{
+		std::cerr << "Invalid parameter." << std::endl;
+		exit(1);
+	}
 
 	Matrix matrix(128, 128);
-	readFileToMatrix(filePath, matrix);
-
-	Matrix result;
-	if (chosenOperator == "quant")
+	if (!readImage(filePath, matrix))
 	{
-		int levels = 8;
-		result = Quantization(matrix, levels);
+		std::cerr << "Error reading the image file." << std::endl;
+		exit(1);
 	}
-	else if (chosenOperator == "blur")
+
+	if (!IsFilter(chosenOperator))
 	{
-		result = Blur(matrix);
+		std::cerr << "Invalid operator selected." << std::endl;
+		exit(1);
 	}
-	else if (chosenOperator == "sobel")
+	Matrix result;
+	try
 	{
-		result = Sobel(matrix);
+		result = ApplyFilter(chosenOperator, matrix, parameter);
 	}
-	else
+	catch (const MatrixException &e)
 	{
-		std::cerr << "Invalid operator selected." << std::endl;
+		std::cerr << e.what();
 		exit(1);
 	}
 
-	writeMatrixToFile(outputFilePath, result);
+	if (!writeImage(outputFilePath, result))
+	{
+		std::cerr << "Error writing the image file." << std::endl;
+		exit(1);
+	}
     return 0;
 }
 #endif
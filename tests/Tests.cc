@@ -0,0 +1,1196 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "../Convolution.h"
+#include "../Decomposition.h"
+#include "../FilterCache.h"
+#include "../FilterServer.h"
+#include "../Filters.h"
+#include "../Histogram.h"
+#include "../Matrix.h"
+#include "../MatrixBatch.h"
+#include "../MatrixException.h"
+#include "../Morphology.h"
+#include "../PackedImage.h"
+#include "../Pipeline.h"
+#include "../Pyramid.h"
+#include "../SparseMatrix.h"
+#include "../ThreadPool.h"
+
+#ifdef FILTER_SERVER_SUPPORTED
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// -------- Static (helper) functions --------
+
+static int checks = 0;
+static int failures = 0;
+
+/**
+ * Records the result of a check, and reports it if it failed.
+ * @param ok the result
+ * @param what the checked expression
+ * @param line the line of the check
+ */
+static void Check(bool ok, const char *what, int line) {
+    checks++;
+    if (!ok){
+        failures++;
+        std::cerr << "Tests.cc:" << line << ": failed: " << what << std::endl;
+    }
+}
+
+#define CHECK(condition) Check((condition), #condition, __LINE__)
+
+/**
+ * @return true if calling f throws a MatrixException.
+ */
+template <typename F>
+static bool Throws(F f) {
+    try{
+        f();
+    } catch (const MatrixException &e) {
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @return a rows x cols matrix of 0, 1, 2, ... row after row.
+ */
+static Matrix Counting(int rows, int cols) {
+    Matrix m(rows, cols);
+    for (int k = 0; k < rows * cols; k++){
+        m[k] = (float)k;
+    }
+    return m;
+}
+
+/**
+ * @return a rows x cols matrix of pseudo random values in [low, high).
+ */
+static Matrix Noise(int rows, int cols, unsigned seed, float low = 0, float high = 256) {
+    Matrix m(rows, cols);
+    for (int k = 0; k < rows * cols; k++){
+        seed = seed * 1664525u + 1013904223u;
+        m[k] = low + (high - low) * (float)(seed >> 8) / (float)(1u << 24);
+    }
+    return m;
+}
+
+/**
+ * @return the largest absolute difference between the elements of a and b,
+ * relative to the largest absolute element of a.
+ */
+static double RelativeError(const Matrix &a, const Matrix &b) {
+    double difference = 0;
+    double scale = 0;
+    for (int i = 0; i < a.GetRows(); i++){
+        for (int j = 0; j < a.GetCols(); j++){
+            difference = std::max(difference, (double)std::fabs(a(i, j) - b(i, j)));
+            scale = std::max(scale, (double)std::fabs(a(i, j)));
+        }
+    }
+    return (scale > 0) ? difference / scale : difference;
+}
+
+/**
+ * @return true if the matrix holds the given elements, row after row.
+ */
+static bool Holds(const Matrix &m, std::initializer_list<float> elements) {
+    int k = 0;
+    for (float e : elements){
+        if (m[k++] != e){
+            return false;
+        }
+    }
+    return k == m.GetRows() * m.GetCols();
+}
+
+// -------- End of static functions --------
+
+// -------- Matrix --------
+
+static void TestOverlappingViews() {
+    Matrix s = Counting(3, 3);
+    s.View(1, 0, 2, 3) = s.View(0, 0, 2, 3);
+    CHECK(Holds(s, {0, 1, 2, 0, 1, 2, 3, 4, 5}));
+
+    s = Counting(3, 3);
+    s.View(0, 0, 2, 3) = s.View(1, 0, 2, 3);
+    CHECK(Holds(s, {3, 4, 5, 6, 7, 8, 6, 7, 8}));
+
+    s = Counting(3, 3);
+    s.View(0, 1, 3, 2) = s.View(0, 0, 3, 2);
+    CHECK(Holds(s, {0, 0, 1, 3, 3, 4, 6, 6, 7}));
+
+    // Different strides over the same memory
+    Matrix t = Counting(1, 12);
+    Matrix wide(t.Data(), 2, 4, 4);
+    Matrix narrow(t.Data() + 1, 2, 4, 5);
+    narrow = wide;
+    CHECK(Holds(narrow, {0, 1, 2, 3, 4, 5, 6, 7}));
+}
+
+static void TestMoveAssignment() {
+    // An owned matrix takes the elements of the temporary
+    Matrix a = Counting(2, 2);
+    Matrix b = Counting(2, 2) * 2;
+    const float *elements = b.Data();
+    a = std::move(b);
+    CHECK(a.Data() == elements);
+    CHECK(Holds(a, {0, 2, 4, 6}));
+
+    // A view is written through
+    Matrix s = Counting(2, 4);
+    Matrix v = s.View(0, 2, 2, 2);
+    v = Counting(2, 2) * 10;
+    CHECK(Holds(s, {0, 1, 0, 10, 4, 5, 20, 30}));
+
+    // A moved from matrix has no elements
+    Matrix moved = std::move(a);
+    CHECK(a.Data() == nullptr);
+    CHECK(Throws([&]{ a.Row(0); }));
+    CHECK(Throws([&]{ Matrix c; c = a; }));
+    a = moved;
+    CHECK(Holds(a, {0, 2, 4, 6}));
+}
+
+static void TestHashOfSharedElements() {
+    Matrix img = Counting(16, 16);
+    Matrix v = img.View(4, 4, 8, 8);
+    uint64_t before = img.Hash();
+    v(2, 2) = 255;
+    CHECK(img.Hash() != before);
+
+    Matrix copy(img);
+    CHECK(copy == img);
+    v(0, 0) = -1;
+    CHECK(copy != img);
+
+    // Wrapped memory which is changed outside the matrix
+    float data[4] = {1, 2, 3, 4};
+    Matrix wrapped(data, 2, 2, 2);
+    before = wrapped.Hash();
+    data[3] = 5;
+    CHECK(wrapped.Hash() != before);
+
+    // An owned matrix keeps its hash until it's changed
+    Matrix owned = Counting(4, 4);
+    before = owned.Hash();
+    CHECK(owned.Hash() == before);
+    owned(1, 1) = 100;
+    CHECK(owned.Hash() != before);
+}
+
+// -------- End of Matrix --------
+
+// -------- MatrixBatch --------
+
+static void TestMatrixBatch() {
+    // Counts which leave a short last block of lanes
+    for (int count : {1, 65, 130}){
+        std::vector<Matrix> left;
+        std::vector<Matrix> right;
+        std::vector<Matrix> other;
+        for (int b = 0; b < count; b++){
+            left.push_back(Noise(3, 4, 100 + b, -2, 2));
+            right.push_back(Noise(4, 5, 300 + b, -2, 2));
+            other.push_back(Noise(3, 4, 500 + b, -2, 2));
+        }
+        MatrixBatch a(left);
+        MatrixBatch b(right);
+        MatrixBatch c(other);
+        CHECK(a.GetCount() == count && a.GetRows() == 3 && a.GetCols() == 4);
+
+        MatrixBatch product = a * b;
+        MatrixBatch sum = a + c;
+        MatrixBatch scaled = a * 1.5f;
+        MatrixBatch accumulated = a;
+        accumulated += c;
+        accumulated *= -0.25f;
+        bool products = product.GetRows() == 3 && product.GetCols() == 5;
+        bool exact = true;
+        for (int k = 0; k < count; k++){
+            products = products && RelativeError(left[k] * right[k], product.Get(k)) < 1e-6;
+            exact = exact && a.Get(k) == left[k] && sum.Get(k) == left[k] + other[k] &&
+                    scaled.Get(k) == left[k] * 1.5f &&
+                    accumulated.Get(k) == (left[k] + other[k]) * -0.25f;
+        }
+        CHECK(products);
+        CHECK(exact);
+
+        // Set changes one matrix of the batch only
+        a.Set(count - 1, other[0]);
+        CHECK(a.Get(count - 1) == other[0] && (count == 1 || a.Get(0) == left[0]));
+        CHECK(a(count - 1, 2, 3) == other[0](2, 3));
+    }
+
+    MatrixBatch a(65, 3, 4);
+    CHECK(Throws([&]{ a * MatrixBatch(65, 3, 4); }));
+    CHECK(Throws([&]{ a * MatrixBatch(64, 4, 4); }));
+    CHECK(Throws([&]{ a + MatrixBatch(65, 4, 3); }));
+    CHECK(Throws([&]{ a += MatrixBatch(66, 3, 4); }));
+    CHECK(Throws([&]{ a.Set(65, Matrix(3, 4)); }));
+    CHECK(Throws([&]{ a.Set(0, Matrix(4, 3)); }));
+}
+
+// -------- End of MatrixBatch --------
+
+// -------- SparseMatrix --------
+
+static void TestSparseConversions() {
+    Matrix dense = Noise(9, 13, 60, -1, 1);
+    for (int k = 0; k < 9 * 13; k += 3){
+        dense[k] = 0;
+    }
+    SparseMatrix all = SparseMatrix::FromDense(dense);
+    CHECK(all.GetRows() == 9 && all.GetCols() == 13 && all.ToDense() == dense);
+    CHECK(all.GetNonZeros() == 9 * 13 - 39 && all(4, 5) == dense(4, 5));
+
+    Matrix kept = dense;
+    for (int k = 0; k < 9 * 13; k++){
+        if (std::fabs(kept[k]) <= 0.5f){
+            kept[k] = 0;
+        }
+    }
+    SparseMatrix large = SparseMatrix::FromDense(dense, 0.5f);
+    CHECK(large.ToDense() == kept);
+    CHECK(SparseMatrix::FromDense(large.ToDense()).ToDense() == kept);
+    CHECK(Throws([&]{ SparseMatrix::FromDense(dense, -1); }));
+
+    // Unsorted, with repeated elements which are summed
+    std::vector<Triplet> triplets = {{2, 3, 1.5f}, {0, 4, -2}, {2, 0, 1}, {2, 3, 0.25f},
+                                     {4, 1, 3}, {0, 0, 5}, {0, 4, 1}, {4, 1, -3}};
+    SparseMatrix coo = SparseMatrix::FromTriplets(5, 6, triplets);
+    Matrix expected(5, 6);
+    for (const Triplet &t : triplets){
+        expected(t.row, t.col) += t.value;
+    }
+    CHECK(coo.ToDense() == expected);
+    std::vector<Triplet> ordered = coo.ToTriplets();
+    bool sorted = (int)ordered.size() == coo.GetNonZeros();
+    for (size_t k = 1; k < ordered.size(); k++){
+        sorted = sorted && (ordered[k - 1].row < ordered[k].row ||
+                            (ordered[k - 1].row == ordered[k].row && ordered[k - 1].col < ordered[k].col));
+    }
+    CHECK(sorted);
+    CHECK(SparseMatrix::FromTriplets(5, 6, ordered).ToDense() == expected);
+    CHECK(Throws([&]{ SparseMatrix::FromTriplets(5, 6, {{5, 0, 1}}); }));
+    CHECK(Throws([&]{ SparseMatrix::FromTriplets(5, 6, {{0, -1, 1}}); }));
+}
+
+static void TestSparseProducts() {
+    // Full rows first, then mostly empty rows, and a full row last: the
+    // bands have to balance the non zeros, not the rows
+    int rows = 2000;
+    int cols = 500;
+    Matrix dense(rows, cols);
+    Matrix values = Noise(rows, cols, 61, -1, 1);
+    for (int i = 0; i < rows; i++){
+        for (int j = 0; j < cols; j++){
+            bool full = i < 140 || i == rows - 1;
+            if (full || (i % 97 == 0 && j % 170 == 0)){
+                dense(i, j) = values(i, j);
+            }
+        }
+    }
+    SparseMatrix sparse = SparseMatrix::FromDense(dense);
+    CHECK((long)sparse.GetNonZeros() + rows >= PARALLEL_MIN_ELEMENTS);
+
+    Matrix rhs = Noise(cols, 7, 62, -1, 1);
+    CHECK(RelativeError(dense * rhs, sparse * rhs) < 1e-5);
+
+    std::vector<float> x(cols);
+    Matrix column(cols, 1);
+    for (int j = 0; j < cols; j++){
+        x[j] = column(j, 0) = std::sin((float)j);
+    }
+    std::vector<float> y = sparse * x;
+    Matrix reference = dense * column;
+    Matrix product(rows, 1);
+    for (int i = 0; i < rows; i++){
+        product(i, 0) = y[i];
+    }
+    CHECK((int)y.size() == rows && RelativeError(reference, product) < 1e-5);
+
+    CHECK(Throws([&]{ sparse * Matrix(cols - 1, 3); }));
+    CHECK(Throws([&]{ sparse * std::vector<float>(cols + 1); }));
+    CHECK(Throws([&]{ sparse(rows, 0); }));
+}
+
+// -------- End of SparseMatrix --------
+
+// -------- Filters --------
+
+/**
+ * Applies f to bands of rows small enough to run serially, each with a halo
+ * of the given amount of rows, and keeps the rows of the band. f is given
+ * the view of the band and the image row the view starts at.
+ * @return the result of f on the whole image, as a serial run computes it.
+ */
+template <typename F>
+static Matrix Banded(Matrix &image, int halo, F f) {
+    const int band = 16;
+    int rows = image.GetRows();
+    Matrix result(rows, image.GetCols());
+    for (int r = 0; r < rows; r += band){
+        int first = std::max(r - halo, 0);
+        int last = std::min(r + band + halo, rows);
+        Matrix part = f(image.View(first, 0, last - first, image.GetCols()), first);
+        for (int i = r; i < std::min(r + band, rows); i++){
+            std::copy(part.Row(i - first), part.Row(i - first) + image.GetCols(), result.Row(i));
+        }
+    }
+    return result;
+}
+
+static void TestParallelIsExact() {
+    // Above PARALLEL_MIN_ELEMENTS, so the rows are split into chunks
+    Matrix image = Noise(512, 512, 27, -20, 280);
+    Matrix other = Noise(512, 512, 28);
+    CHECK(Blur(image) == Banded(image, 1, [](const Matrix &m, int){ return Blur(m); }));
+    CHECK(Sobel(image) == Banded(image, 1, [](const Matrix &m, int){ return Sobel(m); }));
+    CHECK(Quantization(image, 5) == Banded(image, 0, [](const Matrix &m, int){ return Quantization(m, 5); }));
+    CHECK(image * 0.37f == Banded(image, 0, [](const Matrix &m, int){ return m * 0.37f; }));
+    CHECK(image / 3.1f == Banded(image, 0, [](const Matrix &m, int){ return m / 3.1f; }));
+    CHECK(image + other == Banded(image, 0, [&](const Matrix &m, int row){
+        return m + other.View(row, 0, m.GetRows(), m.GetCols());
+    }));
+    Matrix scaled = image;
+    scaled *= 0.37f;
+    CHECK(scaled == Banded(image, 0, [](const Matrix &m, int){ Matrix r = m; r *= 0.37f; return r; }));
+    Matrix divided = image;
+    divided /= 3.1f;
+    CHECK(divided == Banded(image, 0, [](const Matrix &m, int){ Matrix r = m; r /= 3.1f; return r; }));
+    Matrix shifted = image;
+    shifted += 0.7f;
+    CHECK(shifted == Banded(image, 0, [](const Matrix &m, int){ Matrix r = m; r += 0.7f; return r; }));
+    Matrix sum = image;
+    sum += other;
+    CHECK(sum == Banded(image, 0, [&](const Matrix &m, int row){
+        Matrix r = m;
+        r += other.View(row, 0, m.GetRows(), m.GetCols());
+        return r;
+    }));
+}
+
+static void TestQuantizationLevels() {
+    Matrix image = Noise(16, 16, 8);
+    CHECK(ApplyFilter("quant", image) == Quantization(image, 8));
+    CHECK(Throws([&]{ ApplyFilter("quant", image, 0); }));
+    CHECK(Throws([&]{ ApplyFilter("quant", image, 257); }));
+    CHECK(Throws([&]{ ApplyFilter("quant", image, -2); }));
+    for (QuantizationMode mode : {QuantizationMode::UNIFORM, QuantizationMode::OTSU,
+                                  QuantizationMode::MEDIAN_CUT, QuantizationMode::KMEANS}){
+        CHECK(Throws([&]{ Quantization(image, 257, mode); }));
+        CHECK(!Throws([&]{ Quantization(image, 256, mode); }));
+    }
+}
+
+static void TestHistogram() {
+    // Shades are floored, and values out of [0, 255] go to the end bins
+    Matrix image(3, 3);
+    float values[] = {0, 0.5f, -3, 1, 10, 10.9f, 254.9f, 255, 300};
+    for (int k = 0; k < 9; k++){
+        image[k] = values[k];
+    }
+    Histogram shades(image);
+    CHECK(shades.GetBins() == NUM_SHADES && shades.GetTotal() == 9);
+    long expected[NUM_SHADES] = {};
+    expected[0] = 3;
+    expected[1] = 1;
+    expected[10] = 2;
+    expected[254] = 1;
+    expected[255] = 2;
+    bool right = true;
+    for (int b = 0; b < NUM_SHADES; b++){
+        right = right && shades[b] == expected[b];
+    }
+    CHECK(right);
+
+    Matrix unit(2, 4);
+    float fractions[] = {0, 0.1f, 0.3f, 0.5f, 0.99f, 1, -1, 2};
+    for (int k = 0; k < 8; k++){
+        unit[k] = fractions[k];
+    }
+    Histogram quarters(unit, 4, 0, 1);
+    CHECK(quarters[0] == 3 && quarters[1] == 1 && quarters[2] == 1 && quarters[3] == 3);
+
+    // Large enough to be counted in bands
+    Matrix large(512, 512);
+    for (int k = 0; k < 512 * 512; k++){
+        large[k] = (float)(k % NUM_SHADES);
+    }
+    Histogram bands(large);
+    right = bands.GetTotal() == 512 * 512;
+    for (int b = 0; b < NUM_SHADES; b++){
+        right = right && bands[b] == 512 * 512 / NUM_SHADES;
+    }
+    CHECK(right);
+}
+
+static void TestAdaptiveQuantization() {
+    // Two modes, around 40 and around 200: Otsu splits between them
+    Matrix bimodal = Noise(30, 50, 21, 30, 50);
+    Matrix upper = Noise(30, 50, 22, 190, 210);
+    for (int k = 0; k < 30 * 50; k += 2){
+        bimodal[k] = upper[k];
+    }
+    Matrix otsu = Quantization(bimodal, 2, QuantizationMode::OTSU);
+    bool split = true;
+    for (int k = 0; k < 30 * 50; k++){
+        split = split && ((bimodal[k] < 100) ? (otsu[k] >= 30 && otsu[k] < 50)
+                                             : (otsu[k] >= 190 && otsu[k] < 210));
+    }
+    CHECK(split);
+
+    // An image which has exactly as many shades as levels is kept
+    float shades[] = {12, 80, 81, 200, 255};
+    Matrix few(7, 9);
+    for (int k = 0; k < 7 * 9; k++){
+        few[k] = shades[(k * k + k / 5) % 5];
+    }
+    for (QuantizationMode mode : {QuantizationMode::MEDIAN_CUT, QuantizationMode::KMEANS}){
+        CHECK(Quantization(few, 5, mode) == few);
+        Matrix three(4, 6);
+        for (int k = 0; k < 4 * 6; k++){
+            three[k] = (k % 4 == 0) ? 20 : (k % 4 == 1) ? 120 : 220;
+        }
+        CHECK(Quantization(three, 3, mode) == three);
+    }
+}
+
+/**
+ * The rank filter by definition: the 8-bit shades of the window, borders
+ * replicated, sorted.
+ */
+static Matrix NaiveRank(const Matrix &image, int radius, float percentile) {
+    int rows = image.GetRows();
+    int cols = image.GetCols();
+    long side = 2L * radius + 1;
+    size_t rank = (size_t)std::lround(percentile * (float)(side * side - 1));
+    Matrix result(rows, cols);
+    std::vector<float> window;
+    for (int i = 0; i < rows; i++){
+        for (int j = 0; j < cols; j++){
+            window.clear();
+            for (int di = -radius; di <= radius; di++){
+                for (int dj = -radius; dj <= radius; dj++){
+                    float value = image(std::min(std::max(i + di, 0), rows - 1),
+                                        std::min(std::max(j + dj, 0), cols - 1));
+                    window.push_back(std::min(std::max(std::floor(value), 0.0f), 255.0f));
+                }
+            }
+            std::nth_element(window.begin(), window.begin() + rank, window.end());
+            result(i, j) = window[rank];
+        }
+    }
+    return result;
+}
+
+static void TestRankFilter() {
+    // Not square, and with shades out of [0, 255] which are clamped
+    Matrix image = Noise(23, 37, 45, -20, 280);
+    for (int radius : {0, 1, 3, 40}){
+        for (float percentile : {0.0f, 0.5f, 1.0f, 0.3f}){
+            CHECK(RankFilter(image, radius, percentile) == NaiveRank(image, radius, percentile));
+        }
+        CHECK(Median(image, radius) == NaiveRank(image, radius, 0.5f));
+    }
+
+    // Few shades, so the windows have many equal ones
+    Matrix flat = Noise(19, 6, 46, 100, 104);
+    CHECK(Median(flat, 2) == NaiveRank(flat, 2, 0.5f));
+
+    // Large enough to be filtered in bands
+    Matrix large = Noise(300, 250, 47);
+    CHECK(RankFilter(large, 2, 0.7f) == NaiveRank(large, 2, 0.7f));
+
+    CHECK(Throws([&]{ RankFilter(image, -1, 0.5f); }));
+    CHECK(Throws([&]{ RankFilter(image, 1, 1.5f); }));
+}
+
+static void TestIncrementalFilters() {
+    // 37 x 29 in tiles of 8: 5 x 4 tiles, the last ones cut short. Every
+    // round changes the pixels, and gives the tiles which must be redone:
+    // those which hold a changed pixel or have it in their 1 pixel halo.
+    struct Round {
+        std::vector<std::pair<int, int>> pixels;
+        int tiles;
+    };
+    std::vector<Round> rounds = {
+        {{{7, 7}}, 4},  // the corner of 4 tiles
+        {{{0, 0}}, 1},  // the corner of the image
+        {{{36, 28}}, 1},  // the opposite corner, in a short tile
+        {{{16, 20}}, 2},  // the first row of a tile, inside its columns
+        {{{8, 0}}, 2},  // the left border, on a tile boundary
+        {{{7, 7}, {0, 0}, {36, 28}, {16, 20}}, 7},
+        {{}, 0},
+    };
+    for (bool blur : {true, false}){
+        auto filter = [blur](const Matrix &m){ return blur ? Blur(m) : Sobel(m); };
+        Matrix previous = Noise(37, 29, 33);
+        Matrix result = filter(previous);
+        for (const Round &round : rounds){
+            Matrix image = previous;
+            for (const auto &pixel : round.pixels){
+                image(pixel.first, pixel.second) = std::fmod(image(pixel.first, pixel.second) + 97, 256);
+            }
+            int tiles = blur ? BlurIncremental(previous, image, result, 8)
+                             : SobelIncremental(previous, image, result, 8);
+            CHECK(tiles == round.tiles);
+            CHECK(result == filter(image));
+            previous = image;
+        }
+
+        // The default tiles, a change on the corner of 4 of them
+        Matrix large = Noise(64, 64, 34);
+        Matrix changed = large;
+        changed(31, 32) += 1;
+        Matrix patched = filter(large);
+        int tiles = blur ? BlurIncremental(large, changed, patched) : SobelIncremental(large, changed, patched);
+        CHECK(tiles == 4 && patched == filter(changed));
+    }
+}
+
+// -------- End of Filters --------
+
+// -------- Morphology --------
+
+/**
+ * @return the minimum (erode) or maximum of every width x height window,
+ * anchored at (height / 2, width / 2), by brute force.
+ */
+static Matrix NaiveMorphology(const Matrix &image, int width, int height, bool erode) {
+    Matrix res(image.GetRows(), image.GetCols());
+    for (int i = 0; i < image.GetRows(); i++){
+        for (int j = 0; j < image.GetCols(); j++){
+            float best = image(i, j);
+            for (int a = i - height / 2; a < i - height / 2 + height; a++){
+                for (int b = j - width / 2; b < j - width / 2 + width; b++){
+                    if (a >= 0 && a < image.GetRows() && b >= 0 && b < image.GetCols()){
+                        best = erode ? std::min(best, image(a, b)) : std::max(best, image(a, b));
+                    }
+                }
+            }
+            res(i, j) = best;
+        }
+    }
+    return res;
+}
+
+static void TestMorphology() {
+    Matrix image = Noise(70, 150, 9);
+    int elements[][2] = {{1, 1}, {3, 3}, {1, 7}, {8, 2}, {15, 15}, {80, 3}, {3, 90}};
+    for (auto &element : elements){
+        int width = element[0];
+        int height = element[1];
+        Matrix eroded = NaiveMorphology(image, width, height, true);
+        Matrix dilated = NaiveMorphology(image, width, height, false);
+        CHECK(Erode(image, width, height) == eroded);
+        CHECK(Dilate(image, width, height) == dilated);
+        Matrix opened = NaiveMorphology(eroded, width, height, false);
+        Matrix closed = NaiveMorphology(dilated, width, height, true);
+        CHECK(TopHat(image, width, height) == image + opened * -1);
+        CHECK(BlackHat(image, width, height) == closed + image * -1);
+    }
+    CHECK(Throws([&]{ Erode(image, 0, 3); }));
+}
+
+// -------- End of Morphology --------
+
+// -------- Convolution --------
+
+static void TestConvolutionMethods() {
+    Matrix image = Noise(150, 170, 1);
+    int sizes[][2] = {{3, 3}, {5, 9}, {31, 31}, {41, 41}, {64, 17}};
+    for (auto &size : sizes){
+        Matrix kernel = Noise(size[0], size[1], 2, -1, 1);
+        Matrix direct = Convolve(image, kernel, ConvolutionMethod::DIRECT);
+        CHECK(RelativeError(direct, Convolve(image, kernel, ConvolutionMethod::FFT)) < 1e-4);
+        CHECK(RelativeError(direct, Convolve(image, kernel)) < 1e-4);
+    }
+
+    // A rank 1 kernel
+    Matrix column = Noise(15, 1, 3);
+    Matrix row = Noise(1, 11, 4);
+    Matrix kernel = column * row;
+    Matrix direct = Convolve(image, kernel, ConvolutionMethod::DIRECT);
+    CHECK(RelativeError(direct, Convolve(image, kernel, ConvolutionMethod::SEPARABLE)) < 1e-4);
+    CHECK(Throws([&]{ Convolve(image, Noise(5, 5, 5), ConvolutionMethod::SEPARABLE); }));
+}
+
+static void TestKernelSpectrumCache() {
+    Matrix image = Noise(64, 64, 6);
+    Matrix kernel = Noise(21, 21, 7, -1, 1);
+    float *row = kernel.Row(10);
+    Convolve(image, kernel, ConvolutionMethod::FFT);
+
+    // A change which the cached hash of the kernel doesn't see
+    row[10] += 5;
+    Matrix direct = Convolve(image, kernel, ConvolutionMethod::DIRECT);
+    CHECK(RelativeError(direct, Convolve(image, kernel, ConvolutionMethod::FFT)) < 1e-4);
+
+    // More kernels than the cache holds, then the first again
+    for (int k = 0; k < 40; k++){
+        Convolve(image, Noise(9, 9, 100 + k), ConvolutionMethod::FFT);
+    }
+    CHECK(RelativeError(direct, Convolve(image, kernel, ConvolutionMethod::FFT)) < 1e-4);
+}
+
+// -------- End of Convolution --------
+
+// -------- Decomposition --------
+
+/**
+ * @return the largest absolute element of a * x - b, relative to the
+ * largest of |a| * |x|, in double precision.
+ */
+static double Residual(const Matrix &a, const Matrix &x, const Matrix &b) {
+    double residual = 0;
+    double scale = 0;
+    for (int i = 0; i < a.GetRows(); i++){
+        for (int j = 0; j < x.GetCols(); j++){
+            double sum = 0;
+            double magnitude = 0;
+            for (int k = 0; k < a.GetCols(); k++){
+                sum += (double)a(i, k) * x(k, j);
+                magnitude += std::fabs((double)a(i, k) * x(k, j));
+            }
+            residual = std::max(residual, std::fabs(sum - b(i, j)));
+            scale = std::max(scale, magnitude);
+        }
+    }
+    return residual / scale;
+}
+
+static void TestLU() {
+    for (int n : {1, 7, 64, 65, 130}){
+        Matrix a = Noise(n, n, 10 + n, -1, 1);
+        Matrix b = Noise(n, 3, 11 + n, -1, 1);
+        CHECK(Residual(a, Solve(a, b), b) < 1e-5);
+        Matrix inverse = Inverse(a);
+        Matrix identity(n, n);
+        for (int i = 0; i < n; i++){
+            identity(i, i) = 1;
+        }
+        CHECK(Residual(a, inverse, identity) < 1e-5);
+    }
+
+    // A determinant beyond the range of float, and one beyond double
+    Matrix a(300, 300);
+    for (int i = 0; i < 300; i++){
+        a(i, (i + 1) % 300) = (i % 2 == 0) ? 10 : -10;
+    }
+    int sign;
+    double expected = 300 * std::log(10.0);
+    CHECK(std::fabs(std::log(std::fabs(Determinant(a))) - expected) < 1e-9 * expected);
+    CHECK(std::fabs(LogDeterminant(a, sign) - expected) < 1e-9 * expected);
+    CHECK(sign == ((Determinant(a) > 0) ? 1 : -1));
+    Matrix big(400, 400);
+    for (int i = 0; i < 400; i++){
+        big(i, i) = 10;
+    }
+    CHECK(std::fabs(LogDeterminant(big, sign) - 400 * std::log(10.0)) < 1e-9);
+    CHECK(sign == 1);
+
+    Matrix singular = Counting(3, 3);
+    CHECK(LU(singular).IsSingular());
+    CHECK(LogDeterminant(singular, sign) == -std::numeric_limits<double>::infinity() && sign == 0);
+    CHECK(Throws([&]{ Solve(singular, Counting(3, 1)); }));
+}
+
+static void TestCholesky() {
+    for (int n : {1, 9, 64, 100}){
+        Matrix m = Noise(n, n, 20 + n, -1, 1);
+        Matrix a(n, n);
+        for (int i = 0; i < n; i++){
+            for (int j = 0; j < n; j++){
+                double sum = (i == j) ? n : 0;
+                for (int k = 0; k < n; k++){
+                    sum += (double)m(i, k) * m(j, k);
+                }
+                a(i, j) = (float)sum;
+            }
+        }
+        Cholesky cholesky(a);
+        Matrix l = cholesky.GetL();
+        Matrix lt(n, n);
+        for (int i = 0; i < n; i++){
+            for (int j = 0; j < n; j++){
+                lt(i, j) = l(j, i);
+            }
+        }
+        CHECK(Residual(l, lt, a) < 1e-5);
+        Matrix b = Noise(n, 2, 30 + n, -1, 1);
+        CHECK(Residual(a, cholesky.Solve(b), b) < 1e-5);
+        int sign;
+        CHECK(std::fabs(cholesky.LogDeterminant() - LogDeterminant(a, sign)) < 1e-4 * n);
+    }
+    Matrix indefinite(2, 2);
+    indefinite(0, 1) = indefinite(1, 0) = 1;
+    CHECK(Throws([&]{ Cholesky c(indefinite); }));
+}
+
+// -------- End of Decomposition --------
+
+// -------- Pyramid --------
+
+static void TestPyramidLevels() {
+    // Odd sizes halve rounded up, down to a single pixel
+    Matrix image = Noise(129, 67, 40);
+    int sizes[][2] = {{129, 67}, {65, 34}, {33, 17}, {17, 9}, {9, 5}, {5, 3}, {3, 2}, {2, 1}, {1, 1}};
+    Pyramid gaussian(image, 20);
+    CHECK(gaussian.GetLevels() == 9);
+    bool right = true;
+    for (int l = 0; l < gaussian.GetLevels(); l++){
+        Matrix level = gaussian.Level(l);
+        right = right && gaussian.GetRows(l) == sizes[l][0] && gaussian.GetCols(l) == sizes[l][1] &&
+                level.GetRows() == sizes[l][0] && level.GetCols() == sizes[l][1];
+        if (l > 0){
+            right = right && level == Downsample(gaussian.Level(l - 1));
+        }
+    }
+    CHECK(right);
+    CHECK(Pyramid(image, 3).GetLevels() == 3);
+    CHECK(Throws([&]{ Pyramid(image, 0); }));
+    CHECK(gaussian.Reconstruct() == image);
+}
+
+static void TestPyramidReconstruct() {
+    for (int levels : {1, 2, 5, 20}){
+        Pyramid laplacian(Noise(129, 67, 41), levels, PyramidType::LAPLACIAN);
+        CHECK(laplacian.GetType() == PyramidType::LAPLACIAN);
+        CHECK(RelativeError(Noise(129, 67, 41), laplacian.Reconstruct()) < 1e-5);
+    }
+
+    // A constant image stays constant, down and up
+    Matrix constant(37, 22);
+    constant += 7.25f;
+    Matrix down = Downsample(constant);
+    Matrix expected(19, 11);
+    expected += 7.25f;
+    CHECK(down == expected);
+    Matrix up = Upsample(down, 37, 22);
+    CHECK(up.GetRows() == 37 && up.GetCols() == 22 && RelativeError(constant, up) < 1e-6);
+}
+
+// -------- End of Pyramid --------
+
+// -------- PackedImage --------
+
+/**
+ * @return the bytes of the image packed in the given mode.
+ */
+static std::string PackedBytes(const Matrix &image, PackingMode mode) {
+    std::ostringstream output;
+    PackedImage::Pack(image, mode).Write(output);
+    return output.str();
+}
+
+/**
+ * @return true if reading the bytes as a packed image (and unpacking it) throws.
+ */
+static bool Rejected(const std::string &bytes) {
+    return Throws([&]{
+        std::istringstream input(bytes);
+        PackedImage::Read(input).Unpack();
+    });
+}
+
+static void TestPackedRoundTrip() {
+    int sizes[][2] = {{1, 1}, {3, 5}, {128, 128}, {17, 300}};
+    for (auto &size : sizes){
+        Matrix image = Quantization(Noise(size[0], size[1], 40), 6);
+        image(0, 0) = -0.0f;
+        for (PackingMode mode : {PackingMode::AUTO, PackingMode::BITS, PackingMode::RLE,
+                                 PackingMode::RLE_DELTA}){
+            std::istringstream input(PackedBytes(image, mode));
+            PackedImage packed = PackedImage::Read(input);
+            CHECK(packed.Unpack() == image);
+            CHECK(mode == PackingMode::AUTO || packed.GetMode() == mode);
+        }
+    }
+    CHECK(Throws([]{ PackedImage::Pack(Noise(20, 20, 41)); }));
+}
+
+/**
+ * Sets a little endian 32 bit field of packed bytes.
+ */
+static void SetU32(std::string &bytes, size_t offset, uint32_t value) {
+    for (int b = 0; b < 4; b++){
+        bytes[offset + b] = (char)(value >> (8 * b));
+    }
+}
+
+static void TestPackedMalformed() {
+    Matrix image = Quantization(Noise(40, 40, 42), 4);
+    std::string bits = PackedBytes(image, PackingMode::BITS);
+    std::string runs = PackedBytes(image, PackingMode::RLE);
+    size_t size_offset = 8 + 4 + 4 + 2 + 4 * PackedImage::Pack(image).GetPalette().size();
+    CHECK(!Rejected(bits) && !Rejected(runs));
+
+    CHECK(Rejected(""));
+    CHECK(Rejected(bits.substr(0, 12)));
+    CHECK(Rejected("XQPK" + bits.substr(4)));
+    CHECK(Rejected(bits.substr(0, bits.size() - 1)));
+    CHECK(Rejected(runs.substr(0, runs.size() - 1)));
+
+    // Dimensions and sizes which would allocate far more than the file holds
+    std::string corrupt = bits;
+    SetU32(corrupt, 8, 0xffffffff);
+    CHECK(Rejected(corrupt));
+    corrupt = bits;
+    SetU32(corrupt, 8, 1 << 20);
+    SetU32(corrupt, 12, 1 << 20);
+    CHECK(Rejected(corrupt));
+    corrupt = runs;
+    SetU32(corrupt, size_offset, 0xfffffff0);
+    CHECK(Rejected(corrupt));
+    corrupt = runs;
+    SetU32(corrupt, 8, 8192);
+    SetU32(corrupt, 12, 8192);
+    SetU32(corrupt, size_offset, 1 << 26);
+    CHECK(Rejected(corrupt));
+    corrupt = bits;
+    SetU32(corrupt, size_offset, (uint32_t)(bits.size() - size_offset - 4 - 1));
+    CHECK(Rejected(corrupt));
+
+    // Runs past the end of the image, and indices out of the palette
+    corrupt = runs;
+    corrupt[size_offset + 5] = (char)0x7f;
+    CHECK(Rejected(corrupt));
+    corrupt = bits;
+    corrupt[size_offset + 4] = (char)0xff;
+    CHECK(Rejected(corrupt));
+}
+
+// -------- End of PackedImage --------
+
+// -------- FilterCache --------
+
+static void TestCacheChecksInput() {
+    FilterCache cache(4);
+    Matrix img = Counting(32, 32);
+    float *row = img.Row(3);
+    CHECK(cache.Blur(img) == Blur(img));
+
+    // A write which the cached hash of img doesn't see
+    row[7] = 255;
+    CHECK(cache.Blur(img) == Blur(img));
+    CHECK(cache.GetHits() == 0);
+    CHECK(cache.Blur(Matrix(img)) == Blur(img));
+    CHECK(cache.GetHits() == 1);
+}
+
+static void TestCacheOnDisk() {
+    std::string directory = (std::filesystem::temp_directory_path() /
+                             ("filter_cache_test_" + std::to_string(std::rand()))).string();
+    std::vector<Matrix> images;
+    for (int k = 0; k < 8; k++){
+        images.push_back(Counting(16, 16) * (float)(k + 1));
+    }
+
+    // Two caches on one directory, as two processes would share it
+    FilterCache first(6, directory);
+    FilterCache second(6, directory);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++){
+        FilterCache &cache = (t % 2 == 0) ? first : second;
+        threads.emplace_back([&cache, &images, t]{
+            for (int round = 0; round < 20; round++){
+                const Matrix &image = images[(t + round) % images.size()];
+                if (cache.Sobel(image) != Sobel(image)){
+                    std::cerr << "Tests.cc: wrong result from the disk cache" << std::endl;
+                    std::abort();
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads){
+        thread.join();
+    }
+
+    FilterCache third(6, directory);
+    CHECK(third.Sobel(images[0]) == Sobel(images[0]));
+    for (const auto &file : std::filesystem::directory_iterator(directory)){
+        CHECK(file.path().extension() != ".tmp");
+    }
+
+    // Corrupt files are misses: dimensions more than the file holds, or
+    // than any matrix may have, and a file cut short
+    int corrupt[][2] = {{0x7fffffff, 0x7fffffff}, {65536, 65536}, {16, 16}, {1 << 20, 4}};
+    int files = 0;
+    for (const auto &file : std::filesystem::directory_iterator(directory)){
+        std::ofstream out(file.path(), std::ios::binary | std::ios::trunc);
+        out.write((const char *)corrupt[files++ % 4], sizeof(corrupt[0]));
+        out.write("short", 5);
+    }
+    FilterCache fourth(6, directory);
+    bool right = true;
+    for (const Matrix &image : images){
+        right = right && !Throws([&]{ right = right && fourth.Sobel(image) == Sobel(image); });
+    }
+    CHECK(right);
+    CHECK(files > 0 && fourth.GetHits() == 0 && fourth.GetMisses() == (long)images.size());
+    std::filesystem::remove_all(directory);
+}
+
+// -------- End of FilterCache --------
+
+// -------- FilterServer --------
+
+#ifdef FILTER_SERVER_SUPPORTED
+
+/**
+ * @return a socket connected to the path, or -1.
+ */
+static int Connect(const std::string &path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::snprintf(address.sun_path, sizeof(address.sun_path), "%s", path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (sockaddr *)&address, sizeof(address)) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Sends the bytes to a server as they are, and reads until it closes.
+ * @return what the server sent.
+ */
+static std::string RawRequest(const std::string &path, const std::string &request) {
+    int fd = Connect(path);
+    if (fd < 0){
+        return "";
+    }
+    size_t sent = 0;
+    while (sent < request.size()){
+        ssize_t n = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0){
+            break;
+        }
+        sent += n;
+    }
+    shutdown(fd, SHUT_WR);
+    std::string response;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0){
+        response.append(buffer, n);
+    }
+    close(fd);
+    return response;
+}
+
+/**
+ * @return true if the response is an error.
+ */
+static bool IsError(const std::string &response) {
+    return response.compare(0, 6, "ERROR ") == 0;
+}
+
+static void TestServer() {
+    std::string path = (std::filesystem::temp_directory_path() /
+                        ("filter_server_test_" + std::to_string(getpid()))).string();
+
+    // A socket left by a server which is gone is replaced
+    {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        std::snprintf(address.sun_path, sizeof(address.sun_path), "%s", path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        CHECK(bind(fd, (sockaddr *)&address, sizeof(address)) == 0);
+        close(fd);
+    }
+
+    // The socket file is removed with the server
+    {
+        FilterServer server(path);
+        std::thread loop([&]{ server.Run(); });
+
+        struct stat info = {};
+        CHECK(stat(path.c_str(), &info) == 0 && (info.st_mode & 0777) == 0600);
+        CHECK(Throws([&]{ FilterServer second(path); }));
+
+        Matrix image = Noise(40, 30, 17);
+        Matrix expected = ApplyFilter("blur", ApplyFilter("quant", image, 4));
+        CHECK(RequestFilters(path, "quant:4,blur", image) == expected);
+        CHECK(RequestFilters(path, "quant:4,blur", image) == expected);
+        CHECK(Throws([&]{ RequestFilters(path, "quant:0", image); }));
+        CHECK(Throws([&]{ RequestFilters(path, "nothing", image); }));
+
+        // Malformed requests, and requests for a file of the server, are refused
+        CHECK(IsError(RawRequest(path, "blur @/etc/passwd\n")));
+        CHECK(IsError(RawRequest(path, "blur 0 4\n")));
+        CHECK(IsError(RawRequest(path, "blur 2 2 2\n" + std::string(16, '\0'))));
+        CHECK(IsError(RawRequest(path, "blur 4097 4097\n")));
+        CHECK(IsError(RawRequest(path, "blur,quant:x 1 1\n" + std::string(4, '\0'))));
+        CHECK(IsError(RawRequest(path, std::string(5000, 'a'))));
+
+        // Two requests on one connection are answered in order
+        std::string request = "quant:2 2 2\n" + std::string(16, '\0');
+        std::string response = RawRequest(path, request + "blur 2 2\n" + std::string(16, '\0'));
+        size_t one = std::string("OK 2 2\n").size() + 16;
+        CHECK(response.size() == 2 * one && response.compare(0, 7, "OK 2 2\n") == 0 &&
+              response.compare(one, 7, "OK 2 2\n") == 0);
+
+        server.Stop();
+        loop.join();
+    }
+    CHECK(!std::filesystem::exists(path));
+}
+
+#endif //FILTER_SERVER_SUPPORTED
+
+// -------- End of FilterServer --------
+
+// -------- Pipeline --------
+
+static void TestPipelineBuffers() {
+    // "full" fills the image, "short" writes the first row only, "other"
+    // reads an image of other dimensions (as a packed file does), "bad"
+    // fails; every buffer sees all kinds of jobs
+    std::vector<PipelineJob> jobs;
+    const char *kinds[] = {"full", "short", "other", "short", "bad", "full", "short"};
+    for (int round = 0; round < 10; round++){
+        for (const char *kind : kinds){
+            std::string name = kind + std::to_string(jobs.size());
+            jobs.push_back({name, name});
+        }
+    }
+    auto read = [](const std::string &path, Matrix &image){
+        if (path.compare(0, 5, "other") == 0){
+            image = Matrix(3, 5);
+            image(0, 0) = 7;
+            return true;
+        }
+        int rows = (path.compare(0, 4, "full") == 0) ? image.GetRows() : 1;
+        for (int i = 0; i < rows; i++){
+            float *row = image.Row(i);
+            std::fill(row, row + image.GetCols(), (rows == 1) ? 10.0f : 200.0f);
+        }
+        return path.compare(0, 3, "bad") != 0;
+    };
+    std::map<std::string, Matrix> written;
+    auto write = [&](const std::string &path, const Matrix &image){
+        written[path] = image;
+        return true;
+    };
+
+    for (int buffers : {1, 3}){
+        written.clear();
+        Pipeline pipeline(read, [](const Matrix &m){ return Matrix(m); }, write, 6, 4, buffers);
+        CHECK(pipeline.Run(jobs) == 10);
+        CHECK(written.size() == jobs.size() - 10);
+        bool right = true;
+        for (const auto &output : written){
+            const Matrix &image = output.second;
+            const std::string &kind = output.first;
+            if (kind.compare(0, 5, "other") == 0){
+                right = right && image.GetRows() == 3 && image.GetCols() == 5 && image(0, 0) == 7;
+                continue;
+            }
+            right = right && image.GetRows() == 6 && image.GetCols() == 4;
+            for (int i = 0; right && i < 6; i++){
+                for (int j = 0; j < 4; j++){
+                    float expected = (kind.compare(0, 4, "full") == 0) ? 200 : (i == 0) ? 10 : 0;
+                    right = right && image(i, j) == expected;
+                }
+            }
+        }
+        CHECK(right);
+    }
+
+    auto copy = [](const Matrix &m){ return Matrix(m); };
+    CHECK(Throws([&]{ Pipeline(read, copy, write, 6, 4, 2, 0); }));
+}
+
+static void TestPipelineThrows() {
+    // Every stage may throw anything, which counts as a failure of the image
+    std::vector<PipelineJob> jobs;
+    for (int k = 0; k < 40; k++){
+        jobs.push_back({std::to_string(k), std::to_string(k)});
+    }
+    auto read = [](const std::string &path, Matrix &image){
+        if (std::stoi(path) % 5 == 1){
+            throw std::string("unreadable");
+        }
+        image(0, 0) = (float)std::stoi(path);
+        return true;
+    };
+    auto filter = [](const Matrix &image){
+        if ((int)image(0, 0) % 5 == 2){
+            throw 2;
+        }
+        return Matrix(image);
+    };
+    int written = 0;
+    auto write = [&](const std::string &path, const Matrix &image){
+        if (std::stoi(path) % 5 == 3){
+            throw std::runtime_error("unwritable");
+        }
+        written += (image(0, 0) == (float)std::stoi(path));
+        return true;
+    };
+    for (int buffers : {1, 4}){
+        written = 0;
+        Pipeline pipeline(read, filter, write, 2, 2, buffers, 3);
+        CHECK(pipeline.Run(jobs) == 24);
+        CHECK(written == 16);
+    }
+}
+
+// -------- End of Pipeline --------
+
+int main() {
+    TestOverlappingViews();
+    TestMoveAssignment();
+    TestHashOfSharedElements();
+    TestMatrixBatch();
+    TestSparseConversions();
+    TestSparseProducts();
+    TestQuantizationLevels();
+    TestHistogram();
+    TestAdaptiveQuantization();
+    TestParallelIsExact();
+    TestIncrementalFilters();
+    TestRankFilter();
+    TestMorphology();
+    TestConvolutionMethods();
+    TestKernelSpectrumCache();
+    TestLU();
+    TestCholesky();
+    TestPyramidLevels();
+    TestPyramidReconstruct();
+    TestPackedRoundTrip();
+    TestPackedMalformed();
+    TestCacheChecksInput();
+    TestCacheOnDisk();
+#ifdef FILTER_SERVER_SUPPORTED
+    TestServer();
+#endif
+    TestPipelineBuffers();
+    TestPipelineThrows();
+
+    std::cout << checks - failures << " of " << checks << " checks passed." << std::endl;
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}